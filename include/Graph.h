@@ -19,8 +19,12 @@ public:
     // uniform label size
     int labelSize;
 
+    // the number of neighbors kept by the index
     int k;
 
+    // the number of neighbors returned by default, at most k
+    int queryK;
+
     // vertex id -> order id
     vector<int> orderId;
     // order id -> vertex id
@@ -36,6 +40,78 @@ public:
 
     vector<vector<int>> descendants;
 
+    // folder of build checkpoints, empty if checkpoints are disabled
+    string checkpointFolder;
+
+    // seconds between two checkpoints
+    double checkpointInterval = 600;
+
+    // lazy mode: only the down-top index is built,
+    // and the index of a vertex is completed when it is first queried
+    bool lazy = false;
+
+    // the down-top index of each vertex in lazy mode
+    vector<IndexList> downTopList;
+
+    LazyCache lazyCache;
+
+    // POI categories sharing the tree decomposition and shortcuts
+    vector<POICategory> categories;
+
+    // hash-consed index: (labels, base distance, payload) per vertex, reading knn from the pool
+    bool shared = false;
+    vector<vector<tuple<LabelSet, Dist, uint>>> sharedList;
+    KNNPool knnPool;
+
+    // derived vertices store no index, which is rebuilt at query time from their neighbors
+    vector<bool> derived;
+
+    // the distance error bound of an approximate index, 0 for an exact one
+    double epsilon = 0;
+
+    // label masks answered exactly by a pruned index, empty if the index is not pruned
+    vector<bool> profileMask;
+
+    // vertices holding a complete index in a partial index, empty if every vertex does
+    vector<bool> hasIndex;
+
+    // read-optimized copy of the index used by queries while frozen
+    bool frozen = false;
+    FrozenIndex frozenIndex;
+
+    // compressed copy of the index used by queries
+    bool compressed = false;
+    CompressedIndex compressedIndex;
+
+    // tiered mode: index lists are read from the index file on demand and cached under a byte budget
+    bool tiered = false;
+    IndexFile tierFile;
+    LazyCache tierCache;
+    // records read from the index file and their bytes, including prefetched ones
+    LL diskReads = 0;
+    LL diskBytes = 0;
+    LL prefetched = 0;
+
+    // vertices whose index is loaded in a region-scoped load, empty if the whole index is loaded
+    vector<bool> region;
+
+    // the context of the queries of this thread, whose counters the reports read
+    QueryContext queryContext;
+
+    // cache of query results in front of the index, filled by const queries; disabled until enabled
+    mutable ResultCache resultCache;
+    // the version of the index of each vertex, bumped by the updates that change it
+    vector<uint> indexVersion;
+
+    // packed label masks of the index entries for the subset lookup of list queries, empty to test every entry
+    // it describes the lists when it was built, so updates clear it
+    LabelLookup labelLookup;
+    LabelLookup::Strategy lookupStrategy = LabelLookup::Adaptive;
+
+    // the next vertex to compact and the bytes reclaimed by the current compaction pass
+    int compactCursor = 1;
+    LL compactReclaimed = 0;
+
     // load graph file
     Graph(string graphPath, int labelSize, int k);
 
@@ -53,8 +129,11 @@ public:
 
     void loadPOI();
 
+    // load the POI of a category
+    void loadCategory(string name, string poiPath);
+
     // check vertex v is POI
-    int checkPOI(int v);
+    int checkPOI(int v) const;
 
     // obtain the node order in a tree decomposition
     void getOrder(string orderPath);
@@ -71,9 +150,138 @@ public:
     // construct LC-Index in two phases
     void constructIndex();
 
+    // the first phase: merge the index of each vertex into its ancestors
+    // starting from order id
+    void constructDownTop(int id = 1);
+
+    // the second phase: complete the index of each vertex from its ancestors
+    // starting from order id
+    void constructTopDown(int id = -1);
+
+    // the two phases over the lists of an index view
+    void constructDownTop(IndexView &index, int id = 1);
+
+    void constructTopDown(IndexView &index, int id = -1);
+
+    // the step of each phase at vertex v
+    void downTopStep(IndexView &index, int v);
+
+    void topDownStep(IndexView &index, int v);
+
+    // construct LC-Index, keeping the down-top index of each vertex in a scratch file until its top-down step
+    // and streaming its final index into a file once no vertex reads it, return false if a file cannot be written
+    bool constructIndex(string indexPath);
+
+    // write the vertex records scattered over part files into an index file in vertex order,
+    // return false if a part cannot be read or the index file written
+    // location[v] = (part, offset) of the record of v
+    bool assembleIndex(string indexPath, vector<string> parts, vector<pair<int, long>> &location);
+
     // build LC-Index in three steps
     void buildIndex();
 
+    // build LC-Index in three steps, streaming the index into a file
+    bool buildIndex(string indexPath);
+
+    // hash of the POI set, written into the checkpoints so a resume needs the same POI
+    uint64_t poiHash() const;
+
+    // the header of the checkpoint files: graph size, build parameters and POI hash
+    vector<int> checkpointHeader() const;
+
+    // build LC-Index, continuing from the last checkpoint if resume is set
+    void buildIndex(bool resume);
+
+    // move the index into the CSR layout for queries, freeing the index lists
+    void freeze();
+
+    // move the index back into the index lists for updates
+    void thaw();
+
+    // store the frozen index in a file laid out as the frozen index itself
+    void storeFrozenIndex(string indexPath);
+
+    // map a frozen index file and query it in place, with optional read-ahead and huge page hints
+    bool mapFrozenIndex(string indexPath, bool willNeed, bool hugePages);
+
+    // move the index into the compressed encoding for queries, freeing the index lists
+    void compressIndex();
+
+    // store and load the compressed encoding
+    void storeCompressedIndex(string indexPath);
+
+    void loadCompressedIndex(string indexPath);
+
+    // answer queries from the index file, keeping at most budget bytes of index lists in memory
+    bool openTieredIndex(string indexPath, size_t budget);
+
+    // bring the index of v into memory in tiered mode, false if v has no index
+    bool fetch(int v);
+
+    // read the index of v from the index file into the cache of the tiered mode
+    bool readTieredIndex(int v);
+
+    // evict the least recently used indices until the cache of the tiered mode fits its budget
+    void evictTieredIndex();
+
+    // read the uncached indices of the sources of a batch in file order, as far as the budget allows
+    void prefetch(vector<int> &vertices);
+
+    // report the hit rate and disk reads of the tiered mode
+    void reportTieredIndex();
+
+    // the vertices within radius hops of the seeds
+    vector<bool> regionAround(vector<int> &seeds, int radius);
+
+    // the vertices whose coordinates in a DIMACS .co file lie in the box [x1, x2] x [y1, y2]
+    vector<bool> regionInBox(string coordinatePath, double x1, double y1, double x2, double y2);
+
+    // load the index of the vertices in the region only, seeking through the offset table
+    bool loadRegionIndex(string indexPath, vector<bool> &region);
+
+    // report the queries missed by a region-scoped index
+    void reportRegion();
+
+    // build the complete index only for the sources and the ancestors their top-down steps read
+    void buildSourceIndex(vector<int> &sources);
+
+    // build only the down-top index, completing indices on demand under a byte budget
+    void buildLazyIndex(size_t budget);
+
+    // complete the index of v and of the ancestors it depends on
+    void materialize(int v);
+
+    // report the hit rate and memory of the lazy mode
+    void reportLazyCache();
+
+    // build one decomposition and the index of every category in parallel
+    void buildCategoryIndex();
+
+    // report index size and memory of every category
+    void reportCategorySize();
+
+    // split the tree into a top part and disjoint subtrees below it, and assign the subtrees to workers
+    vector<vector<int>> splitSubtrees(int workers, vector<bool> &top);
+
+    // build the index of the given subtrees in a worker process,
+    // shipping contributions to the top part and receiving its complete index over pipes
+    bool runWorker(vector<int> &vertices, vector<bool> &top, FILE *in, FILE *out, string partPath);
+
+    // build LC-Index with worker processes over disjoint subtrees, merging their partial files into indexPath,
+    // return false if a worker or a pipe fails
+    bool buildDistributedIndex(string indexPath, int workers);
+
+    // store the tree decomposition and shortcuts
+    void storeDecomposition(string path);
+
+    bool loadDecomposition(string path);
+
+    // store the index under construction and the position of the next vertex
+    // pass 1: down-top, pass 2: top-down
+    void storeCheckpoint(int pass, int id);
+
+    bool loadCheckpoint(int &pass, int &id);
+
     // prepare for object updates
     void prepareUpdate();
 
@@ -97,14 +305,58 @@ public:
     // query label-constrained knn of s using dijkstra
     vector<PDI> dijkstra(int s, LabelSet labels);
 
+    vector<PDI> dijkstra(int s, LabelSet labels, int k) const;
+
     // compute the number of connected components in the graph
     void countComponent();
 
     // query label-constrained knn of s using indices
     vector<PDI> query(int u, LabelSet labels);
 
+    // answer any k no larger than the k of the index
+    vector<PDI> query(int u, LabelSet labels, int k);
+
+    // reentrant query writing only the context and the result cache, for every mode but the lazy and tiered ones,
+    // which change the index in memory while querying
+    vector<PDI> query(QueryContext &context, int u, LabelSet labels, int k) const;
+
+    // the query behind the result cache
+    vector<PDI> queryIndex(QueryContext &context, int u, LabelSet labels, int k) const;
+
+    // cache up to capacity results in the given number of shards
+    void enableResultCache(size_t capacity, int shards);
+
+    // mark the index of v as changed, invalidating its cached results
+    void bumpVersion(int v);
+
+    // report the hits, misses and invalidations of the result cache
+    void reportResultCache();
+
     vector<PDI> query(IndexList &indexList, int u, LabelSet &labels);
 
+    vector<PDI> query(IndexList &indexList, int u, LabelSet &labels, int k);
+
+    vector<PDI> query(IndexList &indexList, bool poi, int u, LabelSet &labels, int k) const;
+
+    // query the frozen index
+    vector<PDI> queryFrozen(int u, LabelSet labels, int k) const;
+
+    // query the compressed index
+    vector<PDI> queryCompressed(int u, LabelSet labels, int k) const;
+
+    // query the shared index, support receives the union of the entries of all neighbors
+    vector<PDI> queryShared(int u, LabelSet labels, int k, uint &support) const;
+
+    // query over the union of categories by merging the result of each category
+    vector<PDI> query(vector<int> &category, int u, LabelSet labels, int k);
+
+    // process 10,000 queries over the union of all categories
+    void queryCategory(string queryFolder);
+
+    // process 10,000 queries and measure the distance error against dijkstra
+    // (query time in ms, mean relative error, max relative error)
+    tuple<double, double, double> queryApproximate(string queryFolder);
+
     void showIndex();
 
     void showKNN();
@@ -120,12 +372,54 @@ public:
 
     void loadIndex2(string indexPath);
 
+    // load an index file without header, written before the offset table was added
+    void loadSequentialIndex(string indexPath);
+
+    // keep only the k nearest neighbors in an index built for a larger k
+    void shrinkIndex(int k);
+
+    // intern the knn of all index entries into a shared pool and free the index lists
+    void shareIndex();
+
+    // bring the index of shared and derived vertices back into the index lists
+    void restoreIndex();
+
+    // rebuild the index of v from the index of its neighbors, only reading them so that concurrent queries can derive
+    IndexList deriveIndex(int v) const;
+
+    // drop the index of vertices with at most maxWidth stored neighbors that can be rebuilt exactly from them,
+    // when the stored entries are at least ratio times the entries read to rebuild it
+    void deriveIndex(int maxWidth, double ratio);
+
+    // drop the entries whose subsets already answer their label set within (1+epsilon) of every distance
+    void approximateIndex(double epsilon);
+
+    // keep only the entries needed to answer the label masks in a query file exactly
+    void pruneIndex(string profilePath);
+
+    // whether a label mask is answered exactly by the pruned index,
+    // a mask with labels at or above labelSize is outside the profile
+    bool inProfile(uint mask) const;
+
+    // report the fallback rate of a pruned index
+    void reportProfile();
+
     // process 10 groups queries
     void queryByGroup(string queryFolder);
 
+    // pack the label masks of the index for the subset lookup of queries
+    void buildLabelLookup();
+
+    // time the subset lookup strategies on the 10 groups of queries, one group per query label size
+    void queryLookup(string queryFolder);
+
     // process 10,000 queries
     void query(string queryFolder);
 
+    // process the queries with the given number of threads, each with its own query context,
+    // reporting the throughput and the latency of each thread
+    void queryParallel(string queryFolder, int threads);
+
     // randomly generate 10,000 queries and process them
     void query();
 
@@ -138,8 +432,9 @@ public:
     // reconstruct index from scratch to handle object updates
     void reconstructIndex(string poiFolder);
 
-    // process object updates one by one
-    void updatePOI(string poiFolder);
+    // process object updates one by one, on the index of the given category if it is not -1,
+    // where insertions of its POI and deletions of other vertices are skipped
+    void updatePOI(string poiFolder, int category = -1);
 
     // process batch object updates
     void batchUpdate(string poiFolder, string operation);
@@ -154,6 +449,12 @@ public:
     // maintain index after insert an candidate vertex
     void insertPOI(int insertedVertex);
 
+    // maintain the index of category c
+    void insertPOI(int c, int insertedVertex);
+
+    // maintain the POI and lists of an index view
+    void insertPOI(IndexView &index, int insertedVertex);
+
     vector<SCAttr> singleInsert(int insertedVertex);
 
     // process batch object insertions
@@ -162,18 +463,18 @@ public:
     vector<int> getAncestor(int u);
 
     // (id,distance,labels)
-    tuple<int, double, LabelSet> getLastNeighbor(int v, LabelSet labels);
+    tuple<int, Dist, LabelSet> getLastNeighbor(IndexView &index, int v, LabelSet labels);
 
-    bool checkInsertion(int v, SCAttr &path);
+    bool checkInsertion(IndexView &index, int v, SCAttr &path);
 
     // remove useless paths
-    void removeInsertion(int &v, SCAttr &path);
+    void removeInsertion(IndexView &index, int &v, SCAttr &path);
 
     // update own index
-    void updateInsertion(int &v);
+    void updateInsertion(IndexView &index, int &v);
 
     // update index of other vertices
-    void updateInsertion(int insertedVertex, int &v, SCAttr &path);
+    void updateInsertion(IndexView &index, int insertedVertex, int &v, SCAttr &path);
 
     /*
     functions about object deletions
@@ -185,8 +486,23 @@ public:
     // only check partial vertices
     void deletePOI(int deletedVertex);
 
+    void deletePOI(int c, int deletedVertex);
+
+    void deletePOI(IndexView &index, int deletedVertex);
+
     unordered_map<int, bool> singleDelete(int deletedVertex);
 
     // process batch object deletions
     void batchDelete(set<int> &poi);
+
+    /*
+    functions about index compaction
+    */
+
+    // drop the entries made redundant by updates and shrink the storage of the next vertices for at most seconds,
+    // true when a pass over all vertices is complete
+    bool compactIndex(double seconds);
+
+    // compact the whole index in slices of 10ms, as if interleaved with queries
+    void compactIndex();
 };
\ No newline at end of file
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "utils.h"
-typedef pair<LabelSet, double> PLD;
+typedef pair<LabelSet, Dist> PLD;
 // vector<pair<distance,vertex>> list
 struct KNNList
 {
@@ -10,24 +10,24 @@ struct KNNList
 
     KNNList() {}
 
-    KNNList(vector<PDI> list) : list(list) {}
+    KNNList(vector<PDI> list) : list(move(list)) {}
 
-    KNNList(double weight, int vertex)
+    KNNList(Dist weight, int vertex)
     {
         list.emplace_back(make_pair(weight, vertex));
     }
 
-    KNNList operator+(const double &weight)
+    KNNList operator+(const Dist &weight)
     {
         vector<PDI> list;
         list.reserve(this->list.size());
         for (const auto &t : this->list)
-            list.emplace_back(t.first + weight, t.second);
+            list.emplace_back(addDist(t.first, weight), t.second);
         return KNNList(list);
     }
 
     // position,distance,vertex
-    void emplace(int pos, double distance, int &vertex)
+    void emplace(int pos, Dist distance, int &vertex)
     {
         list.emplace(list.begin() + pos, distance, vertex);
     }
@@ -57,7 +57,7 @@ struct IndexList
 
     IndexList() {}
 
-    IndexList(vector<pair<LabelSet, KNNList>> list) : list(list) {}
+    IndexList(vector<pair<LabelSet, KNNList>> list) : list(move(list)) {}
 
     void report() const
     {
@@ -66,20 +66,20 @@ struct IndexList
             printf("labels:%s\n", t.first.c_str().c_str());
             printf("knn: ");
             for (auto t1 : t.second.list)
-                printf("(%d,%.2f) ", t1.second, t1.first);
+                printf("(%d,%.2f) ", t1.second, double(t1.first));
 
             printf("\n");
         }
     }
 
     // combine two KNNs
-    void combine(int owner, IndexList &&other, int &n, int k)
+    void combine(int owner, IndexList &&other, int n, int k)
     {
         if (other.list.empty())
             return;
         if (this->list.empty())
         {
-            this->list = other.list;
+            this->list = move(other.list);
             return;
         }
 
@@ -120,11 +120,11 @@ struct IndexList
             result.emplace_back(move(list2[ptr2]));
             ptr2++;
         }
-        this->list = result;
+        this->list = move(result);
     }
 
     // combine two KNNs
-    void combine(int owner, IndexList &other, int &n, int k)
+    void combine(int owner, IndexList &other, int n, int k)
     {
         if (this->list.empty())
         {
@@ -169,13 +169,13 @@ struct IndexList
             result.emplace_back(move(list2[ptr2]));
             ptr2++;
         }
-        this->list = result;
+        this->list = move(result);
     }
 
     void combine(int owner, SCAttr &path, int insertedVertex, int &n, int k)
     {
         IndexList other;
-        sort(path.attrs.begin(), path.attrs.end(), [](const pair<double, LabelSet> &p1, const pair<double, LabelSet> &p2)
+        sort(path.attrs.begin(), path.attrs.end(), [](const pair<Dist, LabelSet> &p1, const pair<Dist, LabelSet> &p2)
              { return p1.second < p2.second; });
         for (auto &[d, s] : path.attrs)
             other.list.emplace_back(LabelSet(s), KNNList(d, insertedVertex));
@@ -185,7 +185,7 @@ struct IndexList
             return;
         if (this->list.empty())
         {
-            this->list = other.list;
+            this->list = move(other.list);
             return;
         }
 
@@ -226,15 +226,23 @@ struct IndexList
             result.emplace_back(move(list2[ptr2]));
             ptr2++;
         }
-        this->list = result;
+        this->list = move(result);
     }
 
     // down-top: self -> neighbor
     // top-down: neighbor -> self
     // merge shortcuts and neighbor's knn
-    static IndexList join(int owner, SCAttr &scAttr, const IndexList &kNN, int &poi, int &n, int k)
+    static IndexList join(int owner, const SCAttr &scAttr, const IndexList &kNN, int poi, int n, int k)
+    {
+        return utils::dispatchK(k, [&](auto K)
+                                { return join<decltype(K)::value>(owner, scAttr, kNN, poi, n, k); });
+    }
+
+    template <int K>
+    static IndexList join(int owner, const SCAttr &scAttr, const IndexList &kNN, int poi, int n, int k)
     {
-        map<uint, vector<pair<int, int>>> unionSet;
+        ScratchArena::Scope scope;
+        pmr::map<uint, pmr::vector<pair<int, int>>> unionSet(&scope.arena);
         for (int i = scAttr.size() - 1; i >= 0; i--)
         {
             auto &[weight, s1] = scAttr.attrs[i];
@@ -259,67 +267,80 @@ struct IndexList
 
         // combine knn from different combinations
         vector<pair<LabelSet, KNNList>> result(unionSet.size());
+        KNNBuffer<K> ownKNN(k), mergedKNN(k), receivedKNN(k);
         int idx = 0;
         for (auto &[s, index] : unionSet)
         {
             result[idx].first = move(LabelSet(s));
-            vector<PDI> ownKNN;
+            ownKNN.clear();
             for (auto &[i, j] : index)
             {
                 auto &[weight, s1] = scAttr.attrs[i];
+                // shift the neighbor's knn (with the neighbor itself in front) by the shortcut weight
+                receivedKNN.clear();
                 if (j == -1)
-                {
-                    KNNList receivedKNN(weight, poi);
-                    ownKNN = utils::mergeKNN(owner, ownKNN, receivedKNN.list, n, k);
-                }
+                    receivedKNN.emplace_back(weight, poi);
                 else
                 {
-                    auto [s2, receivedKNN] = kNN.list[j];
+                    auto &knn = kNN.list[j].second.list;
                     if (poi)
-                        receivedKNN.emplace(0, 0, poi);
-                    receivedKNN.resize(k);
-                    receivedKNN = receivedKNN + weight;
-                    ownKNN = utils::mergeKNN(owner, ownKNN, receivedKNN.list, n, k);
+                        receivedKNN.emplace_back(weight, poi);
+                    for (int p = 0; p < knn.size() && receivedKNN.size() < (K ? K : k); p++)
+                        receivedKNN.emplace_back(addDist(knn[p].first, weight), knn[p].second);
                 }
+                mergedKNN.clear();
+                utils::mergeKNN<K>(owner, ownKNN, receivedKNN, mergedKNN, n, k);
+                ownKNN.swap(mergedKNN);
             }
-            result[idx].second = move(ownKNN);
+            result[idx].second.list.assign(ownKNN.begin(), ownKNN.end());
             idx++;
         }
-        return IndexList(result);
+        return IndexList(move(result));
+    }
+
+    void compensate(int owner, int poi, int n, int k)
+    {
+        utils::dispatchK(k, [&](auto K)
+                         { compensate<decltype(K)::value>(owner, poi, n, k); });
     }
 
+    template <int K>
     void compensate(int owner, int poi, int n, int k)
     {
-        vector<vector<int>> parents(list.size());
+        ScratchArena::Scope scope;
+        pmr::vector<pmr::vector<int>> parents(list.size(), &scope.arena);
+        // entries already covered by a parent of i, marked with stamp i + 1
+        pmr::vector<int> covered(list.size(), 0, &scope.arena);
 
         for (int i = list.size() - 2; i >= 0; i--)
         {
             parents[i].reserve(list.size() - i);
             auto &[s1, _] = list[i];
-            set<int> st;
             for (int j = i + 1; j < list.size(); j++)
             {
                 auto &[s2, __] = list[j];
-                if (s2.includes(s1) && !st.count(j))
+                if (s2.includes(s1) && covered[j] != i + 1)
                 {
                     parents[i].emplace_back(j);
-                    st.insert(j);
+                    covered[j] = i + 1;
                     for (auto &p : parents[j])
-                        st.insert(p);
+                        covered[p] = i + 1;
                 }
             }
         }
 
-        vector<pair<uint, vector<Index>>> result(list.size());
+        pmr::vector<pair<uint, KNNBuffer<K, Index>>> result(&scope.arena);
+        result.reserve(list.size());
         for (int i = 0; i < list.size(); i++)
         {
             auto &[s, knn] = list[i];
-            result[i].first = s.getLabels();
-            result[i].second.reserve(k);
-            for (auto &[d, v] : knn.list)
-                result[i].second.emplace_back(v, d, s.getLabels());
+            result.emplace_back(s.getLabels(), k);
+            // a list longer than k comes from an index for a larger k
+            for (int p = 0; p < knn.list.size() && p < (K ? K : k); p++)
+                result[i].second.emplace_back(knn.list[p].second, knn.list[p].first, s.getLabels());
         }
 
+        KNNBuffer<K, Index> temp(k);
         for (int i = 0; i < result.size(); i++)
         {
             auto &[s1, knn1] = result[i];
@@ -329,7 +350,11 @@ struct IndexList
                 auto &[s2, knn2] = result[j];
                 // s2 includes s1
                 if ((s2 | s1) == s2)
-                    knn2 = utils::compensateKNN(owner, knn2, knn1, n, k);
+                {
+                    temp.clear();
+                    utils::compensateKNN<K>(owner, knn2, knn1, temp, n, k);
+                    knn2.swap(temp);
+                }
             }
         }
 
@@ -350,27 +375,88 @@ struct IndexList
         newList.reserve(list.size());
         for (auto &[s1, index] : result)
         {
-            vector<PDI> knn;
-            knn.reserve(k);
-            int cnt = 0;
             if (poi && index.size() == k)
                 index.resize(k - 1);
+            int cnt = 0;
             for (auto &[v, d, s2] : index)
-            {
                 if (s2 == s1)
-                {
                     cnt++;
-                    knn.emplace_back(move(d), move(v));
-                }
-            }
             if (cnt)
             {
-                // if (poi && knn.size() == k)
-                //     knn.resize(k - 1);
+                vector<PDI> knn;
+                knn.reserve(cnt);
+                for (auto &[v, d, s2] : index)
+                    if (s2 == s1)
+                        knn.emplace_back(move(d), move(v));
                 newList.emplace_back(move(s1), move(knn));
             }
         }
-        list = newList;
+        list = move(newList);
+    }
+
+    // the k nearest POI of the entries included in labels, merged by a heap over the heads of read-only cursors
+    // ties resolve by entry order as in a scan of the entries; last receives the entry of the last neighbor
+    // and support the union of the entries of all neighbors
+    vector<PDI> select(int owner, bool poi, LabelSet labels, int n, int k, LabelSet *last = nullptr, uint *support = nullptr) const
+    {
+        ScratchArena::Scope scope;
+        pmr::vector<int> entries(&scope.arena);
+        entries.reserve(list.size());
+        for (int e = 0; e < list.size(); e++)
+            if (labels.includes(list[e].first))
+                entries.emplace_back(e);
+        return select(owner, poi, entries.data(), entries.size(), n, k, last, support);
+    }
+
+    // the same selection over the given included entries, in increasing order
+    vector<PDI> select(int owner, bool poi, const int *entries, int count, int n, int k, LabelSet *last = nullptr, uint *support = nullptr) const
+    {
+        if (support)
+            *support = 0;
+        vector<PDI> result;
+        result.reserve(k);
+        auto &visited = VisitMark::local(n);
+        if (poi)
+        {
+            result.emplace_back(0, owner);
+            visited.set(owner);
+        }
+
+        ScratchArena::Scope scope;
+        // (head distance, entry, position) of each included entry, a min-heap
+        pmr::vector<tuple<Dist, int, int>> heap(&scope.arena);
+        heap.reserve(count);
+        for (int i = 0; i < count; i++)
+            if (!list[entries[i]].second.list.empty())
+                heap.emplace_back(list[entries[i]].second.list[0].first, entries[i], 0);
+        auto after = [](const tuple<Dist, int, int> &a, const tuple<Dist, int, int> &b)
+        { return a > b; };
+        make_heap(heap.begin(), heap.end(), after);
+
+        while (result.size() < k && !heap.empty())
+        {
+            pop_heap(heap.begin(), heap.end(), after);
+            auto &[d, e, p] = heap.back();
+            auto &knn = list[e].second.list;
+            int w = knn[p].second;
+            if (!visited.test(w))
+            {
+                result.emplace_back(d, w);
+                visited.set(w);
+                if (last)
+                    *last = list[e].first;
+                if (support)
+                    *support |= list[e].first.getLabels();
+            }
+            if (++p < knn.size())
+            {
+                d = knn[p].first;
+                push_heap(heap.begin(), heap.end(), after);
+            }
+            else
+                heap.pop_back();
+        }
+        return result;
     }
 
     void removeVertex(int u)
@@ -426,6 +512,162 @@ struct IndexList
         list.erase(list.begin() + ptr, list.end());
         return isContaining;
     }
+
+    // binary layout: count, then (labels, size, size * (distance, vertex)) per label set
+    void write(FILE *ofile) const
+    {
+        uint cnt = list.size();
+        fwrite(&cnt, sizeof(cnt), 1, ofile);
+
+        for (auto &[s, knn] : list)
+        {
+            int label = s.getLabels();
+            uint knn_size = knn.list.size();
+            fwrite(&label, sizeof(label), 1, ofile);
+            fwrite(&knn_size, sizeof(knn_size), 1, ofile);
+
+            for (auto &[d, v] : knn.list)
+            {
+                fwrite(&d, sizeof(d), 1, ofile);
+                fwrite(&v, sizeof(v), 1, ofile);
+            }
+        }
+    }
+
+    // the size of the record written by write
+    size_t recordSize() const
+    {
+        size_t size = sizeof(uint);
+        for (auto &[s, knn] : list)
+            size += sizeof(int) + sizeof(uint) + knn.list.size() * (sizeof(Dist) + sizeof(int));
+        return size;
+    }
+
+    // write the record into a buffer, returning its end
+    char *encode(char *p) const
+    {
+        auto put = [&](const void *x, size_t size)
+        {
+            memcpy(p, x, size);
+            p += size;
+        };
+        uint cnt = list.size();
+        put(&cnt, sizeof(cnt));
+        for (auto &[s, knn] : list)
+        {
+            int label = s.getLabels();
+            uint knn_size = knn.list.size();
+            put(&label, sizeof(label));
+            put(&knn_size, sizeof(knn_size));
+            for (auto &[d, v] : knn.list)
+            {
+                put(&d, sizeof(d));
+                put(&v, sizeof(v));
+            }
+        }
+        return p;
+    }
+
+    // read a record from a buffer, returning its end, or nullptr for a vertex without index
+    const char *decode(const char *p)
+    {
+        auto get = [&](void *x, size_t size)
+        {
+            memcpy(x, p, size);
+            p += size;
+        };
+        uint cnt;
+        get(&cnt, sizeof(cnt));
+        list.clear();
+        if (cnt == missing)
+            return nullptr;
+        list.reserve(cnt);
+        for (int i = 0; i < cnt; i++)
+        {
+            uint labels, nums;
+            get(&labels, sizeof(labels));
+            get(&nums, sizeof(nums));
+            vector<PDI> knn(nums);
+            for (auto &[d, v] : knn)
+            {
+                get(&d, sizeof(d));
+                get(&v, sizeof(v));
+            }
+            list.emplace_back(labels, move(knn));
+        }
+        return p;
+    }
+
+    // a record of a vertex without index in a partial index
+    static constexpr uint missing = UINT_MAX;
+
+    static void writeMissing(FILE *ofile)
+    {
+        fwrite(&missing, sizeof(missing), 1, ofile);
+    }
+
+    // return false for a vertex without index
+    // a short read stops early, the caller checks the stream with feof
+    bool read(FILE *ifile)
+    {
+        uint p = missing;
+        fread(&p, sizeof(p), 1, ifile);
+
+        list.clear();
+        if (p == missing)
+            return false;
+        list.reserve(p);
+
+        for (int i = 0; i < p; i++)
+        {
+            uint labels, nums;
+            if (fread(&labels, sizeof(labels), 1, ifile) != 1 || fread(&nums, sizeof(nums), 1, ifile) != 1)
+                break;
+
+            vector<PDI> knn;
+            knn.reserve(nums);
+
+            for (int j = 0; j < nums; j++)
+            {
+                Dist dist;
+                int u;
+                if (fread(&dist, sizeof(dist), 1, ifile) != 1 || fread(&u, sizeof(u), 1, ifile) != 1)
+                    break;
+                knn.emplace_back(dist, u);
+            }
+
+            list.emplace_back(labels, move(knn));
+        }
+        return true;
+    }
+
+    // the number of (distance, vertex) entries
+    size_t entries() const
+    {
+        size_t sum = 0;
+        for (auto &[s, knn] : list)
+            sum += knn.list.size();
+        return sum;
+    }
+
+    bool operator==(const IndexList &other) const
+    {
+        if (list.size() != other.list.size())
+            return false;
+        for (int i = 0; i < list.size(); i++)
+            if (list[i].first.getLabels() != other.list[i].first.getLabels() || list[i].second.list != other.list[i].second.list)
+                return false;
+        return true;
+    }
+
+    // the heap memory held by the index
+    size_t bytes() const
+    {
+        size_t sum = list.capacity() * sizeof(pair<LabelSet, KNNList>);
+        for (auto &[s, knn] : list)
+            sum += knn.list.capacity() * sizeof(PDI);
+        return sum;
+    }
 };
 
 struct TreeNode
@@ -441,4 +683,789 @@ struct TreeNode
 
     // unordered_map<uint, SCAttr> shortcuts;
     IndexList list;
+};
+
+// completed indices of the lazy mode, kept under a byte budget and evicted in LRU order
+struct LazyCache
+{
+    size_t budget = 0;
+    size_t bytes = 0;
+
+    LL hits = 0;
+    LL misses = 0;
+    LL evictions = 0;
+
+    // the most recently used vertex first
+    list<int> order;
+    vector<list<int>::iterator> position;
+    vector<bool> cached;
+
+    void init(int n, size_t budget)
+    {
+        this->budget = budget;
+        bytes = 0;
+        hits = misses = evictions = 0;
+        order.clear();
+        position.assign(n + 1, order.end());
+        cached.assign(n + 1, false);
+    }
+
+    void touch(int v)
+    {
+        order.splice(order.begin(), order, position[v]);
+    }
+
+    void insert(int v, size_t size)
+    {
+        order.push_front(v);
+        position[v] = order.begin();
+        cached[v] = true;
+        bytes += size;
+    }
+};
+
+// a POI category indexed on the shared tree decomposition
+struct POICategory
+{
+    string name;
+    vector<bool> isPOI;
+    vector<IndexList> lists;
+};
+
+// the POI and lists maintained by an update: the index in the tree nodes or the lists of a category
+struct IndexView
+{
+    vector<bool> &isPOI;
+    vector<TreeNode> *trees = nullptr;
+    vector<IndexList> *lists = nullptr;
+
+    IndexView(vector<bool> &isPOI, vector<TreeNode> &trees) : isPOI(isPOI), trees(&trees) {}
+
+    IndexView(vector<bool> &isPOI, vector<IndexList> &lists) : isPOI(isPOI), lists(&lists) {}
+
+    IndexList &operator[](int v) { return trees ? (*trees)[v].list : (*lists)[v]; }
+
+    int checkPOI(int v) const { return isPOI[v] ? v : 0; }
+};
+
+// knn payloads interned across label sets and vertices:
+// a payload is a POI sequence with its distances relative to a base distance
+struct KNNPool
+{
+    vector<int> ids;
+    vector<Dist> deltas;
+    // payload p occupies [offset[p], offset[p + 1])
+    vector<uint> offset = {0};
+    // hash -> payloads
+    unordered_map<size_t, vector<uint>> buckets;
+
+    // (base distance, payload) of a knn list
+    pair<Dist, uint> intern(const vector<PDI> &list)
+    {
+        // shift by the first distance only when base + delta gives back every distance exactly
+        Dist base = list.empty() ? 0 : list[0].first;
+        for (auto &[d, v] : list)
+            if (base + (d - base) != d)
+            {
+                base = 0;
+                break;
+            }
+
+        size_t h = list.size();
+        for (auto &[d, v] : list)
+            h = (h * 1000003) ^ hash<int>()(v) ^ (hash<Dist>()(d - base) << 1);
+        auto &bucket = buckets[h];
+        for (auto &p : bucket)
+            if (equals(p, list, base))
+                return make_pair(base, p);
+
+        uint p = offset.size() - 1;
+        for (auto &[d, v] : list)
+        {
+            ids.emplace_back(v);
+            deltas.emplace_back(d - base);
+        }
+        offset.emplace_back(ids.size());
+        bucket.emplace_back(p);
+        return make_pair(base, p);
+    }
+
+    bool equals(uint p, const vector<PDI> &list, Dist base) const
+    {
+        if (offset[p + 1] - offset[p] != list.size())
+            return false;
+        for (uint i = 0; i < list.size(); i++)
+            if (ids[offset[p] + i] != list[i].second || deltas[offset[p] + i] != list[i].first - base)
+                return false;
+        return true;
+    }
+
+    KNNList decode(Dist base, uint p) const
+    {
+        vector<PDI> list;
+        list.reserve(offset[p + 1] - offset[p]);
+        for (uint i = offset[p]; i < offset[p + 1]; i++)
+            list.emplace_back(base + deltas[i], ids[i]);
+        return KNNList(move(list));
+    }
+
+    size_t payloads() const
+    {
+        return offset.size() - 1;
+    }
+
+    size_t bytes() const
+    {
+        return ids.capacity() * sizeof(int) + deltas.capacity() * sizeof(Dist) + offset.capacity() * sizeof(uint);
+    }
+};
+
+// read-only index in CSR form for queries:
+// the entries of vertex v are [entryOffset[v], entryOffset[v + 1]),
+// and the knn of entry e are [knnOffset[e], knnOffset[e + 1]) of dist and vertex
+// the arrays are reached through pointers, so they can live in this struct or in a mapped file
+struct FrozenIndex
+{
+    int n = 0;
+    const uint *entryOffset = nullptr;
+    const uint *labels = nullptr;
+    const uint64_t *knnOffset = nullptr;
+    const Dist *dist = nullptr;
+    const int *vertex = nullptr;
+
+    vector<uint> entryOffsetData;
+    vector<uint> labelData;
+    vector<uint64_t> knnOffsetData;
+    vector<Dist> distData;
+    vector<int> vertexData;
+
+    // the mapped file when the arrays point into it
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+
+    // file layout: the header, then the five arrays in this order, each aligned to 64 bytes
+    struct Header
+    {
+        char magic[4];
+        uint version;
+        int n, k, labelSize, distSize;
+        uint64_t entries, items;
+    };
+
+    static size_t align(size_t offset)
+    {
+        return (offset + 63) & ~size_t(63);
+    }
+
+    // offsets of the five arrays and the file size
+    static array<size_t, 6> layout(int n, uint64_t entries, uint64_t items)
+    {
+        array<size_t, 6> offset;
+        offset[0] = align(sizeof(Header));
+        offset[1] = align(offset[0] + (n + 2) * sizeof(uint));
+        offset[2] = align(offset[1] + entries * sizeof(uint));
+        offset[3] = align(offset[2] + (entries + 1) * sizeof(uint64_t));
+        offset[4] = align(offset[3] + items * sizeof(Dist));
+        offset[5] = offset[4] + items * sizeof(int);
+        return offset;
+    }
+
+    void unmap()
+    {
+        if (mapping)
+            munmap(mapping, mappingSize);
+        mapping = nullptr;
+        mappingSize = 0;
+    }
+
+    void build(const vector<TreeNode> &trees, int n)
+    {
+        this->n = n;
+        clearData();
+        entryOffsetData.reserve(n + 2);
+        entryOffsetData.emplace_back(0);
+        knnOffsetData.emplace_back(0);
+        for (int v = 0; v <= n; v++)
+        {
+            for (auto &[s, knn] : trees[v].list.list)
+            {
+                labelData.emplace_back(s.getLabels());
+                for (auto &[d, u] : knn.list)
+                {
+                    distData.emplace_back(d);
+                    vertexData.emplace_back(u);
+                }
+                knnOffsetData.emplace_back(distData.size());
+            }
+            entryOffsetData.emplace_back(labelData.size());
+        }
+        bind();
+    }
+
+    void bind()
+    {
+        entryOffset = entryOffsetData.data();
+        labels = labelData.data();
+        knnOffset = knnOffsetData.data();
+        dist = distData.data();
+        vertex = vertexData.data();
+    }
+
+    IndexList thaw(int v) const
+    {
+        IndexList list;
+        list.list.reserve(entryOffset[v + 1] - entryOffset[v]);
+        for (uint e = entryOffset[v]; e < entryOffset[v + 1]; e++)
+        {
+            vector<PDI> knn;
+            knn.reserve(knnOffset[e + 1] - knnOffset[e]);
+            for (uint64_t i = knnOffset[e]; i < knnOffset[e + 1]; i++)
+                knn.emplace_back(dist[i], vertex[i]);
+            list.list.emplace_back(labels[e], move(knn));
+        }
+        return list;
+    }
+
+    void clearData()
+    {
+        vector<uint>().swap(entryOffsetData);
+        vector<uint>().swap(labelData);
+        vector<uint64_t>().swap(knnOffsetData);
+        vector<Dist>().swap(distData);
+        vector<int>().swap(vertexData);
+    }
+
+    size_t bytes() const
+    {
+        size_t entries = entryOffset ? entryOffset[n + 1] : 0;
+        size_t items = knnOffset ? knnOffset[entries] : 0;
+        return (n + 2) * sizeof(uint) + entries * (sizeof(uint) + sizeof(uint64_t)) + sizeof(uint64_t) + items * (sizeof(Dist) + sizeof(int));
+    }
+};
+
+// compressed read-only index for queries:
+// label masks are ids into a dictionary of the distinct masks, vertex ids are bit-packed,
+// and integral distances are varint deltas along each knn list
+struct CompressedIndex
+{
+    int n = 0;
+    int idBits = 1;
+    int labelBits = 1;
+    // whether distances are varint deltas, otherwise they are kept raw
+    bool integral = true;
+
+    // label id -> mask
+    vector<uint> dictionary;
+    // per vertex: first entry, first item and first distance byte
+    vector<uint> entryOffset;
+    vector<uint64_t> itemOffset;
+    vector<uint64_t> byteOffset;
+    // per entry: bit-packed label id, items and distance bytes
+    vector<uint64_t> labelIds;
+    vector<uint16_t> counts;
+    vector<uint16_t> sizes;
+    // per item: bit-packed vertex id and varint distance delta, or raw distance
+    vector<uint64_t> ids;
+    vector<uint8_t> deltas;
+    vector<Dist> raw;
+
+    // the current item of an entry being read
+    struct Cursor
+    {
+        uint64_t byte, item, end;
+        uint64_t prev;
+        Dist dist;
+        int vertex;
+    };
+
+    static void writeBits(vector<uint64_t> &words, uint64_t pos, int bits, uint64_t x)
+    {
+        // one spare word, so readBits may always touch the next word
+        while (words.size() < (pos + bits) / 64 + 2)
+            words.emplace_back(0);
+        int offset = pos & 63;
+        words[pos >> 6] |= x << offset;
+        if (offset + bits > 64)
+            words[(pos >> 6) + 1] |= x >> (64 - offset);
+    }
+
+    static uint64_t readBits(const uint64_t *words, uint64_t pos, int bits)
+    {
+        int offset = pos & 63;
+        uint64_t x = words[pos >> 6] >> offset;
+        if (offset + bits > 64)
+            x |= words[(pos >> 6) + 1] << (64 - offset);
+        return x & ((1ull << bits) - 1);
+    }
+
+    static int bitWidth(uint64_t x)
+    {
+        return max(1, 64 - __builtin_clzll(x | 1));
+    }
+
+    uint label(uint e) const
+    {
+        return dictionary[readBits(labelIds.data(), uint64_t(e) * labelBits, labelBits)];
+    }
+
+    // load the next item into the cursor, false when the entry is exhausted
+    bool next(Cursor &c) const
+    {
+        if (c.item == c.end)
+            return false;
+        c.vertex = readBits(ids.data(), c.item * idBits, idBits);
+        if (integral)
+        {
+            uint64_t x = 0;
+            int shift = 0;
+            uint8_t b;
+            do
+            {
+                b = deltas[c.byte++];
+                x |= uint64_t(b & 127) << shift;
+                shift += 7;
+            } while (b & 128);
+            c.prev += x;
+            c.dist = Dist(c.prev);
+        }
+        else
+            c.dist = raw[c.item];
+        c.item++;
+        return true;
+    }
+
+    void build(const vector<TreeNode> &trees, int n)
+    {
+        *this = CompressedIndex();
+        this->n = n;
+
+        map<uint, uint> dictionaryId;
+        for (int v = 0; v <= n; v++)
+            for (auto &[s, knn] : trees[v].list.list)
+            {
+                dictionaryId.emplace(s.getLabels(), 0);
+                for (auto &[d, u] : knn.list)
+                    integral &= d >= 0 && double(d) < 9e15 && double(d) == double(uint64_t(d));
+            }
+        for (auto &[mask, id] : dictionaryId)
+        {
+            id = dictionary.size();
+            dictionary.emplace_back(mask);
+        }
+        labelBits = bitWidth(max<size_t>(dictionary.size(), 1) - 1);
+        idBits = bitWidth(n);
+
+        uint64_t item = 0;
+        for (int v = 0; v <= n; v++)
+        {
+            entryOffset.emplace_back(counts.size());
+            itemOffset.emplace_back(item);
+            byteOffset.emplace_back(deltas.size());
+            for (auto &[s, knn] : trees[v].list.list)
+            {
+                writeBits(labelIds, uint64_t(counts.size()) * labelBits, labelBits, dictionaryId[s.getLabels()]);
+                size_t start = deltas.size();
+                uint64_t prev = 0;
+                for (auto &[d, u] : knn.list)
+                {
+                    writeBits(ids, item * idBits, idBits, u);
+                    item++;
+                    if (!integral)
+                    {
+                        raw.emplace_back(d);
+                        continue;
+                    }
+                    // knn lists are sorted by distance, so the deltas are not negative
+                    uint64_t x = uint64_t(d) - prev;
+                    prev = uint64_t(d);
+                    do
+                    {
+                        deltas.emplace_back((x & 127) | (x > 127 ? 128 : 0));
+                        x >>= 7;
+                    } while (x);
+                }
+                counts.emplace_back(knn.list.size());
+                sizes.emplace_back(deltas.size() - start);
+            }
+        }
+        entryOffset.emplace_back(counts.size());
+        itemOffset.emplace_back(item);
+        byteOffset.emplace_back(deltas.size());
+        writeBits(labelIds, uint64_t(counts.size()) * labelBits, 0, 0);
+        writeBits(ids, item * idBits, 0, 0);
+    }
+
+    size_t bytes() const
+    {
+        return dictionary.size() * sizeof(uint) + entryOffset.size() * sizeof(uint) + (itemOffset.size() + byteOffset.size() + labelIds.size() + ids.size()) * sizeof(uint64_t) + (counts.size() + sizes.size()) * sizeof(uint16_t) + deltas.size() + raw.size() * sizeof(Dist);
+    }
+};
+
+// an index file: the header, the offset table, then the record of each vertex as written by IndexList::write
+// the record of vertex v is [offset[v - 1], offset[v]), so records can be read in any order
+struct IndexFile
+{
+    struct Header
+    {
+        char magic[4];
+        uint version;
+        int n, k, labelSize, distSize;
+    };
+
+    int fd = -1;
+    Header header;
+    vector<uint64_t> offset;
+
+    // false if the file cannot be opened or has no header, as in the sequential format
+    bool open(string path)
+    {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, "LCKI", 4) || header.version != 1)
+        {
+            close();
+            return false;
+        }
+        offset.resize(header.n + 1);
+        size_t size = offset.size() * sizeof(uint64_t);
+        if (pread(fd, offset.data(), size, sizeof(header)) != size)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // read the record of v, false for a vertex without index
+    bool read(int v, IndexList &list) const
+    {
+        thread_local vector<char> buffer;
+        size_t size = offset[v] - offset[v - 1];
+        buffer.resize(size);
+        if (pread(fd, buffer.data(), size, offset[v - 1]) != size)
+        {
+            list.list.clear();
+            return false;
+        }
+        return list.decode(buffer.data()) != nullptr;
+    }
+
+    void close()
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+};
+
+// the entries of a vertex whose label set is a subset of a query, found by one of two strategies:
+// a scan over the packed masks of the vertex, 8 masks per AVX2 instruction, or for vertices with many entries,
+// enumeration of the submasks of the query against a bitmap over all masks,
+// where the rank of a mask is its entry since the entries of a vertex are sorted by mask
+struct LabelLookup
+{
+    enum Strategy
+    {
+        Adaptive,
+        Scan,
+        Enumerate
+    };
+
+    int n = 0;
+    // the masks of the entries of v are [offset[v], offset[v + 1])
+    vector<uint> offset;
+    vector<uint> masks;
+    // the bitmap of v is bits[bitmap[v] * words, (bitmap[v] + 1) * words), -1 if v is only scanned
+    vector<int> bitmap;
+    int words = 0;
+    vector<uint64_t> bits;
+    // the number of set bits in a bitmap before each of its words
+    vector<uint> rank;
+
+    // vertices with fewer entries are always scanned
+    static constexpr int minEntries = 32;
+    // bitmaps are kept for up to 2^16 masks
+    static constexpr int maxLabelSize = 16;
+
+    bool empty() const
+    {
+        return offset.empty();
+    }
+
+    void clear()
+    {
+        *this = LabelLookup();
+    }
+
+    void build(const vector<TreeNode> &trees, int n, int labelSize)
+    {
+        clear();
+        this->n = n;
+        offset.assign(n + 2, 0);
+        bitmap.assign(n + 1, -1);
+        words = labelSize <= maxLabelSize ? max(1, (1 << labelSize) / 64) : 0;
+        int bitmaps = 0;
+        for (int v = 1; v <= n; v++)
+        {
+            auto &list = trees[v].list.list;
+            offset[v + 1] = offset[v] + list.size();
+            for (auto &[s, knn] : list)
+                masks.emplace_back(s.getLabels());
+
+            bool sorted = is_sorted(list.begin(), list.end(), [](auto &a, auto &b)
+                                    { return a.first < b.first; });
+            if (!words || list.size() < minEntries || !sorted)
+                continue;
+            bitmap[v] = bitmaps++;
+            bits.resize(bitmaps * words, 0);
+            rank.resize(bitmaps * words, 0);
+            uint64_t *b = bits.data() + bitmap[v] * words;
+            for (auto &[s, knn] : list)
+                b[s.getLabels() / 64] |= 1ull << (s.getLabels() % 64);
+            uint *r = rank.data() + bitmap[v] * words;
+            for (int w = 1; w < words; w++)
+                r[w] = r[w - 1] + __builtin_popcountll(b[w - 1]);
+        }
+        // the scan reads whole vectors of 8 masks
+        masks.resize(masks.size() + 8, 0);
+    }
+
+    // enumerate when the submasks of the query are fewer than the vector steps of a scan
+    bool enumerates(int v, uint mask) const
+    {
+        if (bitmap[v] < 0)
+            return false;
+        uint64_t submasks = 1ull << __builtin_popcount(mask);
+        return submasks * 2 < offset[v + 1] - offset[v];
+    }
+
+    // the entries of v included in mask in increasing order, returning their number
+    int lookup(int v, uint mask, Strategy strategy, int *entries) const
+    {
+        bool enumerate = strategy == Enumerate ? bitmap[v] >= 0 : strategy == Adaptive && enumerates(v, mask);
+        if (enumerate)
+            return lookupSubmasks(v, mask, entries);
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        const uint *m = masks.data() + offset[v];
+        int size = offset[v + 1] - offset[v];
+        return avx2 ? scanAVX2(m, size, mask, entries) : scanScalar(m, size, mask, entries);
+    }
+
+    int lookupSubmasks(int v, uint mask, int *entries) const
+    {
+        const uint64_t *b = bits.data() + bitmap[v] * words;
+        const uint *r = rank.data() + bitmap[v] * words;
+        int cnt = 0;
+        // submasks in decreasing order, so the entries are found from the last one
+        for (uint sub = mask;; sub = (sub - 1) & mask)
+        {
+            if (sub < words * 64u)
+            {
+                uint64_t word = b[sub / 64];
+                uint64_t bit = 1ull << (sub % 64);
+                if (word & bit)
+                    entries[cnt++] = r[sub / 64] + __builtin_popcountll(word & (bit - 1));
+            }
+            if (!sub)
+                break;
+        }
+        reverse(entries, entries + cnt);
+        return cnt;
+    }
+
+    static int scanScalar(const uint *masks, int size, uint mask, int *entries)
+    {
+        int cnt = 0;
+        for (int e = 0; e < size; e++)
+            if (!(masks[e] & ~mask))
+                entries[cnt++] = e;
+        return cnt;
+    }
+
+    __attribute__((target("avx2"))) static int scanAVX2(const uint *masks, int size, uint mask, int *entries)
+    {
+        int cnt = 0;
+        __m256i outside = _mm256_set1_epi32(~mask);
+        __m256i zero = _mm256_setzero_si256();
+        for (int e = 0; e < size; e += 8)
+        {
+            __m256i m = _mm256_loadu_si256((const __m256i *)(masks + e));
+            __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(m, outside), zero);
+            uint found = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+            // the lanes past the entries of the vertex belong to the next vertex or the padding
+            if (size - e < 8)
+                found &= (1u << (size - e)) - 1;
+            while (found)
+            {
+                entries[cnt++] = e + __builtin_ctz(found);
+                found &= found - 1;
+            }
+        }
+        return cnt;
+    }
+
+    size_t bytes() const
+    {
+        return (offset.size() + masks.size() + rank.size()) * sizeof(uint) + bitmap.size() * sizeof(int) + bits.size() * sizeof(uint64_t);
+    }
+};
+
+// the state of a query that is not shared between threads: scratch buffers and counters
+// a const query writes only its context, so threads with their own contexts can query one graph
+struct QueryContext
+{
+    // the entries found by the label lookup
+    vector<int> entries;
+
+    // queries answered by the index and by dijkstra as the fallback of a pruned index
+    LL profileQueries = 0;
+    // queries answered by dijkstra since the index misses their mask or source
+    LL fallbackQueries = 0;
+    // queries from outside the region, which have no answer
+    LL regionMisses = 0;
+
+    // whether the last query had no answer since its source is outside the region,
+    // its empty result is not the same as having no reachable POI
+    bool miss = false;
+    // whether the last query was answered by dijkstra rather than the index,
+    // its result depends on more than the index of its source, so it is not cached
+    bool fallback = false;
+
+    // the union of the label sets of the entries that gave the last result, or its whole query mask
+    // when the result was not selected from index entries
+    uint support = 0;
+
+    void merge(const QueryContext &other)
+    {
+        profileQueries += other.profileQueries;
+        fallbackQueries += other.fallbackQueries;
+        regionMisses += other.regionMisses;
+    }
+};
+
+// results of (vertex, label mask) queries, sharded by vertex with an LRU list per shard
+// an entry holds the version of the index of its vertex when it was computed, and is dropped once the version changes
+struct ResultCache
+{
+    struct Entry
+    {
+        int u;
+        uint mask;
+        // the union of the entries that gave the result, see QueryContext::support
+        uint support;
+        uint version;
+        int k;
+        vector<PDI> result;
+    };
+
+    struct Shard
+    {
+        mutex lock;
+        // the most recently used entry first
+        list<Entry> order;
+        unordered_map<uint64_t, list<Entry>::iterator> position;
+        // the cached masks of each vertex, searched for supersets of a query
+        unordered_map<int, vector<uint>> masks;
+
+        LL hits = 0;
+        LL supersetHits = 0;
+        LL misses = 0;
+        LL invalidations = 0;
+        LL evictions = 0;
+    };
+
+    size_t capacity = 0;
+    vector<unique_ptr<Shard>> shards;
+
+    bool enabled() const
+    {
+        return !shards.empty();
+    }
+
+    void init(size_t capacity, int shardCount)
+    {
+        this->capacity = max<size_t>(1, capacity / shardCount);
+        shards.clear();
+        for (int i = 0; i < shardCount; i++)
+            shards.emplace_back(make_unique<Shard>());
+    }
+
+    static uint64_t key(int u, uint mask)
+    {
+        return uint64_t(u) << 32 | mask;
+    }
+
+    // the first k neighbors of a cached result of (u, mask), or of a cached superset mask
+    // whose result was selected only from entries included in mask, so it is also the result of mask
+    bool find(int u, uint mask, uint version, int k, vector<PDI> &result)
+    {
+        auto &shard = *shards[u % shards.size()];
+        lock_guard<mutex> guard(shard.lock);
+        auto found = shard.masks.find(u);
+        if (found == shard.masks.end())
+        {
+            shard.misses++;
+            return false;
+        }
+        auto &masks = found->second;
+        for (int i = 0; i < masks.size(); i++)
+        {
+            uint m = masks[i];
+            if ((m & mask) != mask)
+                continue;
+            auto it = shard.position.at(key(u, m));
+            if (it->version != version)
+            {
+                shard.invalidations++;
+                // erasing the last mask of u also erases its vector
+                bool last = masks.size() == 1;
+                erase(shard, it);
+                if (last)
+                    break;
+                i--;
+                continue;
+            }
+            if (it->k < k || (m != mask && (it->support & ~mask)))
+                continue;
+            result.assign(it->result.begin(), it->result.begin() + min<size_t>(k, it->result.size()));
+            shard.order.splice(shard.order.begin(), shard.order, it);
+            if (m == mask)
+                shard.hits++;
+            else
+                shard.supersetHits++;
+            return true;
+        }
+        shard.misses++;
+        return false;
+    }
+
+    void insert(int u, uint mask, uint support, uint version, int k, const vector<PDI> &result)
+    {
+        auto &shard = *shards[u % shards.size()];
+        lock_guard<mutex> guard(shard.lock);
+        auto found = shard.position.find(key(u, mask));
+        if (found != shard.position.end())
+            erase(shard, found->second);
+        shard.order.push_front(Entry{u, mask, support, version, k, result});
+        shard.position[key(u, mask)] = shard.order.begin();
+        shard.masks[u].emplace_back(mask);
+        while (shard.order.size() > capacity)
+        {
+            shard.evictions++;
+            erase(shard, prev(shard.order.end()));
+        }
+    }
+
+    // the vector of a vertex is erased with its last mask, so the map holds only cached vertices
+    static void erase(Shard &shard, list<Entry>::iterator it)
+    {
+        auto found = shard.masks.find(it->u);
+        auto &masks = found->second;
+        masks.erase(std::find(masks.begin(), masks.end(), it->mask));
+        if (masks.empty())
+            shard.masks.erase(found);
+        shard.position.erase(key(it->u, it->mask));
+        shard.order.erase(it);
+    }
 };
\ No newline at end of file
@@ -13,12 +13,24 @@
 #include <algorithm>
 #include <getopt.h>
 #include <climits>
+#include <cassert>
 #include <map>
 #include <chrono>
 #include <omp.h>
 #include <tuple>
 #include <stack>
 #include <unordered_set>
+#include <list>
+#include <memory_resource>
+#include <sstream>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <immintrin.h>
+#include <mutex>
 
 using namespace std;
 using namespace chrono;
@@ -27,28 +39,55 @@ using namespace chrono;
 
 typedef long long LL;
 typedef unsigned int uint;
-typedef pair<double, int> PDI;
+// distance type of edges, shortcuts and index entries
+// selected at build time by make DIST=double|float|uint
+#if defined(DIST_FLOAT)
+typedef float Dist;
+#elif defined(DIST_UINT)
+typedef uint Dist;
+#else
+typedef double Dist;
+#endif
+
+typedef pair<Dist, int> PDI;
 typedef pair<uint, uint> PUU;
 typedef pair<uint, double> PUD;
 typedef pair<int, int> PII;
 
+// add two distances, stopping on integer overflow
+// sums reaching inf would collide with the sentinel for unreachable vertices
+inline Dist addDist(Dist d1, Dist d2)
+{
+#ifdef DIST_UINT
+    Dist sum;
+    if (__builtin_add_overflow(d1, d2, &sum) || sum >= Dist(inf))
+    {
+        fprintf(stderr, "distance overflow: %u + %u\n", d1, d2);
+        exit(1);
+    }
+    return sum;
+#else
+    return d1 + d2;
+#endif
+}
+
 struct GraphEdge
 {
     uint target;
-    double weight;
+    Dist weight;
     uint label;
 
     GraphEdge() : target(0), weight(0), label(0) {}
 
-    GraphEdge(uint target, double weight, uint label) : target(target), weight(weight), label(label) {}
+    GraphEdge(uint target, Dist weight, uint label) : target(target), weight(weight), label(label) {}
 };
 
 struct Index
 {
     int vertex;
-    double distance;
+    Dist distance;
     uint labels;
-    Index(int vertex, double distance, uint labels) : vertex(vertex), distance(distance), labels(labels) {}
+    Index(int vertex, Dist distance, uint labels) : vertex(vertex), distance(distance), labels(labels) {}
     Index() {}
 };
 
@@ -150,23 +189,23 @@ struct LabelSet
 struct SCAttr
 {
     // distance, labels
-    vector<pair<double, LabelSet>> attrs;
+    vector<pair<Dist, LabelSet>> attrs;
 
     SCAttr() : attrs() {}
 
     void report()
     {
         for (auto &p : attrs)
-            printf("(%.2lf,%s) ", p.first, p.second.c_str().c_str());
+            printf("(%.2lf,%s) ", double(p.first), p.second.c_str().c_str());
         printf("\n");
     }
 
-    int size()
+    int size() const
     {
         return attrs.size();
     }
 
-    void emplace_back_attr(double distance, uint label)
+    void emplace_back_attr(Dist distance, uint label)
     {
         attrs.emplace_back(distance, LabelSet(label));
     }
@@ -211,13 +250,13 @@ struct SCAttr
             }
 
         // merge two shortcuts
-        vector<pair<double, LabelSet>> temp;
+        vector<pair<Dist, LabelSet>> temp;
         temp.reserve(attrs1.size() + attrs2.size());
         int i = 0, j = 0;
         while (i < attrs1.size() && j < attrs2.size())
         {
-            double &d1 = attrs1[i].first;
-            double &d2 = attrs2[j].first;
+            Dist &d1 = attrs1[i].first;
+            Dist &d2 = attrs2[j].first;
 
             if (d1 <= d2)
             {
@@ -294,7 +333,7 @@ struct SCAttr
             for (auto &p1 : o1)
                 // path from v to w
                 for (auto &p2 : o2)
-                    o.emplace_back(p1.first + p2.first, p1.second + p2.second);
+                    o.emplace_back(addDist(p1.first, p2.first), p1.second + p2.second);
         sort(o.begin(), o.end());
 
         attr.removeRedundancy();
@@ -312,30 +351,283 @@ struct SCAttr
     }
 };
 
+// bump allocator for the temporary containers of join and compensate
+// chunks are kept per thread and rewound after each step, so a warm pass does not hit malloc
+class ScratchArena : public pmr::memory_resource
+{
+    // (base, size)
+    vector<pair<char *, size_t>> chunks;
+    size_t chunk = 0;
+    size_t offset = 0;
+
+public:
+    ~ScratchArena()
+    {
+        for (auto &[base, size] : chunks)
+            ::operator delete(base);
+    }
+
+    static ScratchArena &local()
+    {
+        thread_local ScratchArena arena;
+        return arena;
+    }
+
+    // rewind the arena to its position at construction time
+    struct Scope
+    {
+        ScratchArena &arena;
+        size_t chunk, offset;
+
+        Scope() : arena(local()), chunk(arena.chunk), offset(arena.offset) {}
+
+        ~Scope()
+        {
+            arena.chunk = chunk;
+            arena.offset = offset;
+        }
+    };
+
+protected:
+    void *do_allocate(size_t bytes, size_t alignment) override
+    {
+        while (chunk < chunks.size())
+        {
+            auto &[base, size] = chunks[chunk];
+            size_t p = (offset + alignment - 1) & ~(alignment - 1);
+            if (p + bytes <= size)
+            {
+                offset = p + bytes;
+                return base + p;
+            }
+            chunk++;
+            offset = 0;
+        }
+        size_t size = max(bytes + alignment, chunks.empty() ? size_t(1 << 16) : chunks.back().second * 2);
+        chunks.emplace_back((char *)::operator new(size), size);
+        chunk = chunks.size() - 1;
+        offset = bytes;
+        return chunks.back().first;
+    }
+
+    void do_deallocate(void *, size_t, size_t) override {}
+
+    bool do_is_equal(const pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+// mark the vertices seen by a merge without clearing an n-sized array on each call
+struct VisitMark
+{
+    vector<uint> stamp;
+    uint epoch = 0;
+
+    static VisitMark &local(int n)
+    {
+        thread_local VisitMark mark;
+        mark.reset(n);
+        return mark;
+    }
+
+    void reset(int n)
+    {
+        if (stamp.size() < n + 1)
+            stamp.resize(n + 1, 0);
+        if (++epoch == 0)
+        {
+            fill(stamp.begin(), stamp.end(), 0);
+            epoch = 1;
+        }
+    }
+
+    bool test(int v) const
+    {
+        return stamp[v] == epoch;
+    }
+
+    void set(int v)
+    {
+        stamp[v] = epoch;
+    }
+};
+
+// knn buffer with inline storage for a compile-time K
+// K == 0 is the generic path and keeps its items in the scratch arena
+template <int K, class T = PDI>
+struct KNNBuffer
+{
+    T items[K];
+    int count = 0;
+
+    // k is taken for the interface of the generic buffer, dispatchK picks K equal to it
+    KNNBuffer(int k)
+    {
+        assert(k == K);
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    void clear()
+    {
+        count = 0;
+    }
+
+    // callers stop at K items, the inline storage has no room beyond them
+    template <class... Args>
+    void emplace_back(Args &&...args)
+    {
+        assert(count < K);
+        items[count++] = T(forward<Args>(args)...);
+    }
+
+    void resize(int size)
+    {
+        count = min(count, size);
+    }
+
+    void swap(KNNBuffer &other)
+    {
+        int size = max(count, other.count);
+        for (int i = 0; i < size; i++)
+            std::swap(items[i], other.items[i]);
+        std::swap(count, other.count);
+    }
+
+    T &operator[](int i)
+    {
+        return items[i];
+    }
+
+    const T &operator[](int i) const
+    {
+        return items[i];
+    }
+
+    T *begin()
+    {
+        return items;
+    }
+
+    T *end()
+    {
+        return items + count;
+    }
+};
+
+template <class T>
+struct KNNBuffer<0, T>
+{
+    pmr::vector<T> items;
+
+    KNNBuffer(int k) : items(&ScratchArena::local())
+    {
+        items.reserve(k);
+    }
+
+    size_t size() const
+    {
+        return items.size();
+    }
+
+    void clear()
+    {
+        items.clear();
+    }
+
+    template <class... Args>
+    void emplace_back(Args &&...args)
+    {
+        items.emplace_back(forward<Args>(args)...);
+    }
+
+    void resize(int size)
+    {
+        if (items.size() > size)
+            items.resize(size);
+    }
+
+    void swap(KNNBuffer &other)
+    {
+        items.swap(other.items);
+    }
+
+    T &operator[](int i)
+    {
+        return items[i];
+    }
+
+    const T &operator[](int i) const
+    {
+        return items[i];
+    }
+
+    T *begin()
+    {
+        return items.data();
+    }
+
+    T *end()
+    {
+        return items.data() + items.size();
+    }
+};
+
 struct utils
 {
+    // call f with the compile-time specialization of k, or with 0 for the generic path
+    template <class F>
+    static auto dispatchK(int k, F &&f)
+    {
+        switch (k)
+        {
+        case 10:
+            return f(integral_constant<int, 10>());
+        case 20:
+            return f(integral_constant<int, 20>());
+        case 50:
+            return f(integral_constant<int, 50>());
+        default:
+            return f(integral_constant<int, 0>());
+        }
+    }
+
     // merge two KNNs from down to top(owner==0) or top to down(owner!=0)
-    // vector<pair<double,int>>
+    // vector<pair<Dist,int>>
     template <class C1, class C2>
     static vector<PDI> mergeKNN(int &owner, C1 &ownKNN, C2 &receivedKNN, int &n, int &k)
     {
         vector<PDI> result;
         result.reserve(k);
-        vector<bool> hasPOI(n + 1, false);
+        mergeKNN(owner, ownKNN, receivedKNN, result, n, k);
+        return result;
+    }
+
+    // merge two KNNs into result, which is expected to be empty
+    // a non-zero K fixes the result size at compile time
+    template <int K = 0, class C1, class C2, class C3>
+    static void mergeKNN(int &owner, C1 &ownKNN, C2 &receivedKNN, C3 &result, int &n, int &kk)
+    {
+        const int k = K ? K : kk;
+        auto &hasPOI = VisitMark::local(n);
         int ptr1 = 0, ptr2 = 0;
         // knn:(distance,vertex)
         while (ptr1 < ownKNN.size() && ptr2 < receivedKNN.size())
         {
             if (result.size() == k)
-                return result;
+                return;
             auto &[d1, v1] = ownKNN[ptr1];
             auto &[d2, v2] = receivedKNN[ptr2];
-            if (hasPOI[v1] || v1 == owner)
+            if (hasPOI.test(v1) || v1 == owner)
             {
                 ptr1++;
                 continue;
             }
-            if (hasPOI[v2] || v2 == owner)
+            if (hasPOI.test(v2) || v2 == owner)
             {
                 ptr2++;
                 continue;
@@ -344,25 +636,25 @@ struct utils
             if (d1 < d2)
             {
                 result.emplace_back(move(ownKNN[ptr1]));
-                hasPOI[v1] = true;
+                hasPOI.set(v1);
                 ptr1++;
             }
             else if (d2 < d1)
             {
                 result.emplace_back(move(receivedKNN[ptr2]));
-                hasPOI[v2] = true;
+                hasPOI.set(v2);
                 ptr2++;
             }
             else
             {
                 result.emplace_back(move(ownKNN[ptr1]));
-                hasPOI[v1] = true;
+                hasPOI.set(v1);
                 if (result.size() == k)
-                    return result;
-                if (!hasPOI[v2])
+                    return;
+                if (!hasPOI.test(v2))
                 {
                     result.emplace_back(move(receivedKNN[ptr2]));
-                    hasPOI[v2] = true;
+                    hasPOI.set(v2);
                 }
                 ptr1++;
                 ptr2++;
@@ -372,12 +664,12 @@ struct utils
         while (ptr1 < ownKNN.size())
         {
             if (result.size() == k)
-                return result;
+                return;
             int &v = ownKNN[ptr1].second;
-            if (!hasPOI[v] && v != owner)
+            if (!hasPOI.test(v) && v != owner)
             {
                 result.emplace_back(move(ownKNN[ptr1]));
-                hasPOI[v] = true;
+                hasPOI.set(v);
             }
             ptr1++;
         }
@@ -385,39 +677,37 @@ struct utils
         while (ptr2 < receivedKNN.size())
         {
             if (result.size() == k)
-                return result;
+                return;
             int &v = receivedKNN[ptr2].second;
-            if (!hasPOI[v] && v != owner)
+            if (!hasPOI.test(v) && v != owner)
             {
                 result.emplace_back(move(receivedKNN[ptr2]));
-                hasPOI[v] = true;
+                hasPOI.set(v);
             }
             ptr2++;
         }
-
-        return result;
     }
 
-    // compensate two KNNs
+    // compensate two KNNs into result, which is expected to be empty
     // vector<Index> = vector<vertex,distance,labels>
-    template <class C1, class C2>
-    static vector<Index> compensateKNN(int owner, C1 &ownKNN, const C2 &receivedKNN, int &n, int &k)
+    template <int K = 0, class C1, class C2, class C3>
+    static void compensateKNN(int owner, C1 &ownKNN, const C2 &receivedKNN, C3 &result, int &n, int &kk)
     {
-        vector<Index> result;
-        vector<bool> hasPOI(n + 1, false);
+        const int k = K ? K : kk;
+        auto &hasPOI = VisitMark::local(n);
         int ptr1 = 0, ptr2 = 0;
         while (ptr1 < ownKNN.size() && ptr2 < receivedKNN.size())
         {
             if (result.size() == k)
-                return result;
+                return;
             auto &[v1, d1, s1] = ownKNN[ptr1];
             const auto &[v2, d2, s2] = receivedKNN[ptr2];
-            if (hasPOI[v1] || v1 == owner)
+            if (hasPOI.test(v1) || v1 == owner)
             {
                 ptr1++;
                 continue;
             }
-            if (hasPOI[v2] || v2 == owner)
+            if (hasPOI.test(v2) || v2 == owner)
             {
                 ptr2++;
                 continue;
@@ -425,29 +715,13 @@ struct utils
             if (d1 < d2)
             {
                 result.emplace_back(move(ownKNN[ptr1]));
-                // result.emplace_back(v1, d1, s1);
-                hasPOI[v1] = true;
+                hasPOI.set(v1);
                 ptr1++;
             }
-            else if (d2 < d1)
-            {
-                result.emplace_back(v2, d2, s2);
-                hasPOI[v2] = true;
-                ptr2++;
-            }
             else
             {
                 result.emplace_back(v2, d2, s2);
-                hasPOI[v2] = true;
-                // if (result.size() == k)
-                //     return result;
-                // if (!hasPOI[v1])
-                // {
-                //     result.emplace_back(move(ownKNN[ptr1]));
-                //     // result.emplace_back(v1, d1, s1);
-                //     hasPOI[v1] = true;
-                // }
-                // ptr1++;
+                hasPOI.set(v2);
                 ptr2++;
             }
         }
@@ -455,13 +729,12 @@ struct utils
         while (ptr1 < ownKNN.size())
         {
             if (result.size() == k)
-                return result;
+                return;
             auto &[v1, d1, s1] = ownKNN[ptr1];
-            if (!hasPOI[v1] && v1 != owner)
+            if (!hasPOI.test(v1) && v1 != owner)
             {
                 result.emplace_back(move(ownKNN[ptr1]));
-                // result.emplace_back(v1, d1, s1);
-                hasPOI[v1] = true;
+                hasPOI.set(v1);
             }
             ptr1++;
         }
@@ -469,16 +742,14 @@ struct utils
         while (ptr2 < receivedKNN.size())
         {
             if (result.size() == k)
-                return result;
+                return;
             auto &[v2, d2, s2] = receivedKNN[ptr2];
-            if (!hasPOI[v2] && v2 != owner)
+            if (!hasPOI.test(v2) && v2 != owner)
             {
                 result.emplace_back(v2, d2, s2);
-                hasPOI[v2] = true;
+                hasPOI.set(v2);
             }
             ptr2++;
         }
-
-        return result;
     }
 };
\ No newline at end of file
@@ -60,6 +60,24 @@ void Graph::reportIndexSize()
     printf("index size:%.2lfMB\n", indexSize);
 }
 
+void Graph::reportCategorySize()
+{
+    for (auto &category : categories)
+    {
+        LL labelCount = 0;
+        LL indexCount = 0;
+        LL bytes = 0;
+        for (int i = 1; i <= n; i++)
+        {
+            labelCount += category.lists[i].list.size();
+            indexCount += category.lists[i].entries();
+            bytes += category.lists[i].bytes();
+        }
+        double indexSize = (n * 4 + labelCount * 4 + indexCount * 8) / 1024 / 1024.0;
+        printf("category %s: index size:%.2lfMB, memory:%.2lfMB\n", category.name.c_str(), indexSize, bytes / 1024.0 / 1024.0);
+    }
+}
+
 void Graph::countComponent()
 {
     int cnt = 0;
@@ -153,7 +171,7 @@ void Graph::checkIndex()
             {
                 auto &[d1, v1] = knn1[i];
                 auto &[d2, v2] = knn2[i];
-                if (abs(d1 - d2) > 1e-8)
+                if (abs(double(d1) - double(d2)) > 1e-8)
                 {
                     flag = true;
                     wrong++;
@@ -221,13 +239,13 @@ void Graph::showKNN()
             auto knn1 = query(v, label);
             printf("label:%s\n", label.c_str().c_str());
             for (auto &[d, v] : knn1)
-                printf("(%.2lf,%d) ", d, v);
+                printf("(%.2lf,%d) ", double(d), v);
             printf("\n\n");
 
             printf("dijkstra\n");
             auto knn2 = dijkstra(v, label);
             for (auto &[d, v] : knn2)
-                printf("(%.2lf,%d) ", d, v);
+                printf("(%.2lf,%d) ", double(d), v);
             printf("\n\n");
         }
     }
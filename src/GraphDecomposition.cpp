@@ -168,9 +168,9 @@ void Graph::refine()
                         auto &[d, s] = attrs[p];
                         auto &[d2, s2] = attrs2[j];
 
-                        if (d1 >= d2 + d && s1.includes(s2 + s))
+                        if (d1 >= addDist(d2, d) && s1.includes(s2 + s))
                         {
-                            d1 = d2 + d;
+                            d1 = addDist(d2, d);
                             s1 = s2 + s;
                             flags[v][u][i] = 1;
                         }
@@ -219,24 +219,400 @@ void Graph::refine()
 }
 
 void Graph::constructIndex()
+{
+    constructDownTop();
+    constructTopDown();
+}
+
+void Graph::constructDownTop(int start)
 {
     // down-top(knn)
     printf("start building the index from down to top...\n");
-    for (int id = 1; id <= n; id++)
+    IndexView index(isPOI, trees);
+    constructDownTop(index, start);
+}
+
+// only the main index is checkpointed, the passes otherwise read the shared decomposition and shortcuts
+void Graph::constructDownTop(IndexView &index, int start)
+{
+    auto lastCheckpoint = chrono::high_resolution_clock::now();
+    for (int id = start; id <= n; id++)
     {
-        int v = orderMap[id];
-        int poiV = checkPOI(v);
-        trees[v].list.compensate(v, poiV, n, k);
-        for (auto &u : trees[v].neighbors)
-            trees[u]
-                .list.combine(u, IndexList::join(u, shortcuts[v][u], trees[v].list, poiV, n, k), n, k);
+        if (index.trees && !checkpointFolder.empty())
+        {
+            chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - lastCheckpoint;
+            if (elapsed.count() >= checkpointInterval)
+            {
+                storeCheckpoint(1, id);
+                lastCheckpoint = chrono::high_resolution_clock::now();
+            }
+        }
+
+        downTopStep(index, orderMap[id]);
     }
+}
+
+void Graph::downTopStep(IndexView &index, int v)
+{
+    int poiV = index.checkPOI(v);
+    index[v].compensate(v, poiV, n, k);
+    for (auto &u : trees[v].neighbors)
+        index[u].combine(u, IndexList::join(u, shortcuts[v].at(u), index[v], poiV, n, k), n, k);
+}
 
+void Graph::constructTopDown(int start)
+{
     // top-down(knn)
     printf("start building the index from top to down...\n");
+    IndexView index(isPOI, trees);
+    constructTopDown(index, start);
+}
+
+void Graph::constructTopDown(IndexView &index, int start)
+{
+    if (start == -1)
+        start = n;
+    auto lastCheckpoint = chrono::high_resolution_clock::now();
+    for (int id = start; id; id--)
+    {
+        if (index.trees && !checkpointFolder.empty())
+        {
+            chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - lastCheckpoint;
+            if (elapsed.count() >= checkpointInterval)
+            {
+                storeCheckpoint(2, id);
+                lastCheckpoint = chrono::high_resolution_clock::now();
+            }
+        }
+
+        topDownStep(index, orderMap[id]);
+    }
+}
+
+void Graph::topDownStep(IndexView &index, int v)
+{
+    for (auto &u : trees[v].neighbors)
+    {
+        int poiU = index.checkPOI(u);
+        index[v].combine(v, IndexList::join(v, shortcuts[v].at(u), index[u], poiU, n, k), n, k);
+    }
+    int poiV = index.checkPOI(v);
+    index[v].compensate(v, poiV, n, k);
+}
+
+void Graph::buildIndex()
+{
+    auto start = chrono::high_resolution_clock::now();
+
+    treeDecomposition();
+    refine();
+    constructIndex();
+
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> duration = end - start;
+    printf("indexing time:%.2lfs\n", duration.count());
+
+    calculateStats();
+    reportIndexSize();
+}
+
+bool Graph::constructIndex(string indexPath)
+{
+    // the down-top index of a vertex is complete after its own step and read again only by its top-down step,
+    // so it waits in a scratch file in between
+    string downPath = indexPath + ".down";
+    string partPath = indexPath + ".part";
+    FILE *down = fopen(downPath.c_str(), "wb+");
+    FILE *part = fopen(partPath.c_str(), "wb");
+    auto fail = [&](string path)
+    {
+        cerr << "Failed to write file: " << path << "\n";
+        if (down)
+            fclose(down);
+        if (part)
+            fclose(part);
+        filesystem::remove(downPath);
+        filesystem::remove(partPath);
+        return false;
+    };
+    if (!down || !part)
+        return fail(down ? partPath : downPath);
+
+    // a preorder of the tree, where each vertex follows its ancestors and each subtree is contiguous,
+    // so an index waits in memory only while the subtree below it is built
+    vector<int> order;
+    order.reserve(n);
+    vector<int> stack;
+    for (int id = n; id; id--)
+        if (trees[orderMap[id]].parent == -1)
+            stack.emplace_back(orderMap[id]);
+    while (!stack.empty())
+    {
+        int v = stack.back();
+        stack.pop_back();
+        order.emplace_back(v);
+        for (auto &c : trees[v].children)
+            stack.emplace_back(c);
+    }
+
+    IndexView index(isPOI, trees);
+    vector<long> spilled(n + 1);
+    // (distance, vertex) entries held in memory
+    LL resident = 0;
+    LL peak = 0;
+
+    printf("start building the index from down to top and spilling it...\n");
+    for (int i = n - 1; i >= 0; i--)
+    {
+        int v = order[i];
+        resident -= trees[v].list.entries();
+        for (auto &u : trees[v].neighbors)
+            resident -= trees[u].list.entries();
+        downTopStep(index, v);
+        for (auto &u : trees[v].neighbors)
+            resident += trees[u].list.entries();
+        peak = max(peak, resident + LL(trees[v].list.entries()));
+
+        spilled[v] = ftell(down);
+        trees[v].list.write(down);
+        vector<pair<LabelSet, KNNList>>().swap(trees[v].list.list);
+    }
+    if (ferror(down))
+        return fail(downPath);
+    LL downTopPeak = peak;
+    peak = 0;
+
+    printf("start building the index from top to down and streaming it...\n");
+    // the number of vertices whose top-down step still reads the index of each vertex
+    vector<int> readers(n + 1, 0);
+    for (int v = 1; v <= n; v++)
+        for (auto &u : trees[v].neighbors)
+            readers[u]++;
+
+    vector<pair<int, long>> location(n + 1);
+    LL labelCount = 0;
+    LL indexCount = 0;
+
+    auto spill = [&](int v)
+    {
+        auto &list = trees[v].list;
+        location[v] = make_pair(0, ftell(part));
+        list.write(part);
+        LL entries = list.entries();
+        resident -= entries;
+        labelCount += list.list.size();
+        indexCount += entries;
+        vector<pair<LabelSet, KNNList>>().swap(list.list);
+    };
+
+    for (auto &v : order)
+    {
+        // a record cut short by the end of the scratch file fails the build
+        if (fseek(down, spilled[v], SEEK_SET) != 0)
+            return fail(downPath);
+        trees[v].list.read(down);
+        if (ferror(down) || feof(down))
+            return fail(downPath);
+        topDownStep(index, v);
+        resident += trees[v].list.entries();
+        peak = max(peak, resident);
+
+        // neighbors are ancestors, so they are final once their last reader is done
+        for (auto &u : trees[v].neighbors)
+            if (!--readers[u])
+                spill(u);
+        if (!readers[v])
+            spill(v);
+    }
+    fclose(down);
+    down = nullptr;
+    filesystem::remove(downPath);
+    bool written = !ferror(part);
+    written = !fclose(part) && written;
+    part = nullptr;
+    if (!written)
+        return fail(partPath);
+
+    // the size of a record is known only once it is final, so the records are copied into vertex order once
+    bool assembled = assembleIndex(indexPath, {partPath}, location);
+    filesystem::remove(partPath);
+    if (!assembled)
+        return false;
+
+    printf("peak resident index entries of the down-top phase:%lld of %lld (%.2lf%%)\n", downTopPeak, indexCount, indexCount ? 100.0 * downTopPeak / indexCount : 0.0);
+    printf("peak resident index entries of the top-down phase:%lld of %lld (%.2lf%%)\n", peak, indexCount, indexCount ? 100.0 * peak / indexCount : 0.0);
+    double indexSize = (n * 4 + labelCount * 4 + indexCount * 8) / 1024 / 1024.0;
+    printf("index size:%.2lfMB\n", indexSize);
+    return true;
+}
+
+bool Graph::assembleIndex(string indexPath, vector<string> parts, vector<pair<int, long>> &location)
+{
+    printf("store index file...\n");
+    // write a temporary file and rename it, so the index file is never left half written
+    string tempPath = indexPath + ".tmp";
+    FILE *ofile = fopen(tempPath.c_str(), "wb");
+    if (!ofile)
+    {
+        cerr << "Failed to open file: " << tempPath << "\n";
+        return false;
+    }
+    bool flag = true;
+    vector<FILE *> ifiles;
+    for (auto &part : parts)
+    {
+        FILE *ifile = fopen(part.c_str(), "rb");
+        if (!ifile)
+        {
+            cerr << "Failed to open file: " << part << "\n";
+            flag = false;
+            break;
+        }
+        ifiles.emplace_back(ifile);
+    }
+
+    // the offset table is known only after the records are copied, so it is written last
+    IndexFile::Header header = {{'L', 'C', 'K', 'I'}, 1, n, k, labelSize, int(sizeof(Dist))};
+    vector<uint64_t> table(n + 1);
+    if (flag)
+    {
+        flag &= fwrite(&header, sizeof(header), 1, ofile) == 1;
+        flag &= fwrite(table.data(), sizeof(uint64_t), table.size(), ofile) == table.size();
+        table[0] = ftell(ofile);
+    }
+
+    IndexList list;
+    for (int v = 1; v <= n && flag; v++)
+    {
+        auto &[part, offset] = location[v];
+        FILE *ifile = ifiles[part];
+        if (!(flag = fseek(ifile, offset, SEEK_SET) == 0))
+            break;
+        // a record cut short by the end of its part fails the copy
+        list.read(ifile);
+        if (!(flag = !ferror(ifile) && !feof(ifile)))
+            break;
+        list.write(ofile);
+        table[v] = ftell(ofile);
+    }
+    if (flag)
+    {
+        flag &= fseek(ofile, sizeof(header), SEEK_SET) == 0;
+        flag &= fwrite(table.data(), sizeof(uint64_t), table.size(), ofile) == table.size();
+        // the error indicator of the stream covers the writes of the records
+        flag &= !ferror(ofile);
+    }
+
+    for (auto &ifile : ifiles)
+        fclose(ifile);
+    flag &= fclose(ofile) == 0;
+    if (!flag)
+    {
+        cerr << "Failed to write file: " << tempPath << "\n";
+        filesystem::remove(tempPath);
+        return false;
+    }
+    filesystem::rename(tempPath, indexPath);
+    return true;
+}
+
+bool Graph::buildIndex(string indexPath)
+{
+    auto start = chrono::high_resolution_clock::now();
+
+    treeDecomposition();
+    refine();
+    if (!constructIndex(indexPath))
+        return false;
+
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> duration = end - start;
+    printf("indexing time:%.2lfs\n", duration.count());
+    return true;
+}
+
+void Graph::buildIndex(bool resume)
+{
+    auto start = chrono::high_resolution_clock::now();
+
+    string decompositionPath = checkpointFolder + "/decomposition.bin";
+    int pass = 1, id = 1;
+    if (resume && loadDecomposition(decompositionPath))
+    {
+        // without an index checkpoint, the construction restarts after the decomposition
+        loadCheckpoint(pass, id);
+        printf("resume from pass %d at order %d\n", pass, id);
+    }
+    else
+    {
+        if (resume)
+            printf("no checkpoint to resume, build from scratch\n");
+        treeDecomposition();
+        refine();
+        storeDecomposition(decompositionPath);
+    }
+
+    if (pass == 1)
+    {
+        constructDownTop(id);
+        id = n;
+    }
+    constructTopDown(id);
+
+    // the index is complete, so the checkpoints are no longer valid
+    filesystem::remove(decompositionPath);
+    filesystem::remove(checkpointFolder + "/checkpoint.bin");
+
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> duration = end - start;
+    printf("indexing time:%.2lfs\n", duration.count());
+
+    calculateStats();
+    reportIndexSize();
+}
+
+void Graph::buildSourceIndex(vector<int> &sources)
+{
+    auto start = chrono::high_resolution_clock::now();
+
+    treeDecomposition();
+    refine();
+    constructDownTop();
+
+    // the top-down step of a vertex reads the complete index of its neighbors
+    hasIndex.assign(n + 1, false);
+    vector<int> stack;
+    for (auto &v : sources)
+        if (!hasIndex[v])
+        {
+            hasIndex[v] = true;
+            stack.emplace_back(v);
+        }
+    while (!stack.empty())
+    {
+        int v = stack.back();
+        stack.pop_back();
+        for (auto &u : trees[v].neighbors)
+            if (!hasIndex[u])
+            {
+                hasIndex[u] = true;
+                stack.emplace_back(u);
+            }
+    }
+
+    printf("start building the index from top to down for the sources...\n");
+    LL freed = 0;
+    int count = 0;
     for (int id = n; id; id--)
     {
         int v = orderMap[id];
+        if (!hasIndex[v])
+        {
+            freed += trees[v].list.bytes();
+            vector<pair<LabelSet, KNNList>>().swap(trees[v].list.list);
+            continue;
+        }
+        count++;
         for (auto &u : trees[v].neighbors)
         {
             int poiU = checkPOI(u);
@@ -247,22 +623,133 @@ void Graph::constructIndex()
         int poiV = checkPOI(v);
         trees[v].list.compensate(v, poiV, n, k);
     }
+
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> duration = end - start;
+    printf("indexing time:%.2lfs\n", duration.count());
+
+    LL bytes = 0;
+    for (int v = 1; v <= n; v++)
+        bytes += trees[v].list.bytes();
+    printf("sources:%ld, vertices with index:%d (%.2lf%%)\n", sources.size(), count, 100.0 * count / n);
+    printf("index memory:%.2lfMB, freed down-top memory:%.2lfMB\n", bytes / 1024.0 / 1024.0, freed / 1024.0 / 1024.0);
+    reportIndexSize();
+}
+
+void Graph::buildLazyIndex(size_t budget)
+{
+    auto start = chrono::high_resolution_clock::now();
+
+    treeDecomposition();
+    refine();
+    constructDownTop();
+
+    downTopList.resize(n + 1);
+    for (int v = 1; v <= n; v++)
+        downTopList[v].list = move(trees[v].list.list);
+    lazy = true;
+    lazyCache.init(n, budget);
+
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> duration = end - start;
+    printf("indexing time:%.2lfs\n", duration.count());
+
+    LL bytes = 0;
+    for (int v = 1; v <= n; v++)
+        bytes += downTopList[v].bytes();
+    printf("down-top index memory:%.2lfMB\n", bytes / 1024.0 / 1024.0);
+}
+
+void Graph::materialize(int v)
+{
+    if (lazyCache.cached[v])
+    {
+        lazyCache.hits++;
+        lazyCache.touch(v);
+        return;
+    }
+    lazyCache.misses++;
+
+    // the top-down step of v reads the complete indices of its neighbors, which are ancestors
+    vector<int> pending;
+    auto &visited = VisitMark::local(n);
+    vector<int> stack = {v};
+    visited.set(v);
+    while (!stack.empty())
+    {
+        int w = stack.back();
+        stack.pop_back();
+        pending.emplace_back(w);
+        for (auto &u : trees[w].neighbors)
+            if (!lazyCache.cached[u] && !visited.test(u))
+            {
+                visited.set(u);
+                stack.emplace_back(u);
+            }
+    }
+    sort(pending.begin(), pending.end(), [&](int a, int b)
+         { return orderId[a] > orderId[b]; });
+
+    for (auto &w : pending)
+    {
+        trees[w].list = downTopList[w];
+        for (auto &u : trees[w].neighbors)
+        {
+            int poiU = checkPOI(u);
+            trees[w].list.combine(w, IndexList::join(w, shortcuts[w][u], trees[u].list, poiU, n, k), n, k);
+        }
+        trees[w].list.compensate(w, checkPOI(w), n, k);
+        lazyCache.insert(w, trees[w].list.bytes());
+    }
+    // v was inserted last, so it is the most recently used
+    lazyCache.touch(v);
+
+    // evict only after the whole chain is complete, since it reads the indices of ancestors
+    while (lazyCache.bytes > lazyCache.budget && lazyCache.order.size() > 1)
+    {
+        int u = lazyCache.order.back();
+        lazyCache.order.pop_back();
+        lazyCache.cached[u] = false;
+        lazyCache.bytes -= trees[u].list.bytes();
+        lazyCache.evictions++;
+        vector<pair<LabelSet, KNNList>>().swap(trees[u].list.list);
+    }
 }
 
-void Graph::buildIndex()
+void Graph::reportLazyCache()
+{
+    LL sum = lazyCache.hits + lazyCache.misses;
+    printf("lazy index hits:%lld, misses:%lld, hit rate:%.2lf%%\n", lazyCache.hits, lazyCache.misses, sum ? 100.0 * lazyCache.hits / sum : 0.0);
+    printf("lazy index evictions:%lld, cached vertices:%ld, cached memory:%.2lfMB\n", lazyCache.evictions, lazyCache.order.size(), lazyCache.bytes / 1024.0 / 1024.0);
+}
+
+void Graph::buildCategoryIndex()
 {
     auto start = chrono::high_resolution_clock::now();
 
     treeDecomposition();
     refine();
-    constructIndex();
+    for (int v = 1; v <= n; v++)
+        for (auto &u : trees[v].neighbors)
+            descendants[u].emplace_back(v);
+
+    // the categories only read the shared decomposition and shortcuts
+    printf("start building the index of %ld categories...\n", categories.size());
+#pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < categories.size(); c++)
+    {
+        categories[c].lists.assign(n + 1, IndexList());
+        IndexView index(categories[c].isPOI, categories[c].lists);
+        constructDownTop(index);
+        constructTopDown(index);
+    }
 
     auto end = chrono::high_resolution_clock::now();
     chrono::duration<double> duration = end - start;
     printf("indexing time:%.2lfs\n", duration.count());
 
     calculateStats();
-    reportIndexSize();
+    reportCategorySize();
 }
 
 void Graph::prepareUpdate()
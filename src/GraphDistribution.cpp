@@ -0,0 +1,352 @@
+#include "../include/Graph.h"
+
+vector<vector<int>> Graph::splitSubtrees(int workers, vector<bool> &top)
+{
+    // the number of vertices in the subtree of each vertex, parents have larger order ids
+    vector<int> size(n + 1, 1);
+    for (int id = 1; id <= n; id++)
+    {
+        int v = orderMap[id];
+        if (trees[v].parent != -1)
+            size[trees[v].parent] += size[v];
+    }
+
+    // move the root of the largest subtree into the top part until the subtrees are small enough to balance
+    top.assign(n + 1, false);
+    priority_queue<pair<int, int>> pieces;
+    for (int v = 1; v <= n; v++)
+        if (trees[v].parent == -1)
+            pieces.emplace(size[v], v);
+    int limit = max(1, n / (workers * 4));
+    int topSize = 0;
+    while (!pieces.empty() && pieces.top().first > limit && topSize < n / 2)
+    {
+        int v = pieces.top().second;
+        pieces.pop();
+        top[v] = true;
+        topSize++;
+        for (auto &u : trees[v].children)
+            pieces.emplace(size[u], u);
+    }
+
+    // give the largest remaining subtree to the least loaded worker
+    vector<vector<int>> assigned(workers);
+    priority_queue<pair<LL, int>, vector<pair<LL, int>>, greater<pair<LL, int>>> load;
+    for (int w = 0; w < workers; w++)
+        load.emplace(0, w);
+    while (!pieces.empty())
+    {
+        auto [s, root] = pieces.top();
+        pieces.pop();
+        auto [l, w] = load.top();
+        load.pop();
+        load.emplace(l + s, w);
+
+        vector<int> stack = {root};
+        while (!stack.empty())
+        {
+            int v = stack.back();
+            stack.pop_back();
+            assigned[w].emplace_back(v);
+            for (auto &u : trees[v].children)
+                stack.emplace_back(u);
+        }
+    }
+    for (auto &vertices : assigned)
+        sort(vertices.begin(), vertices.end(), [&](int a, int b)
+             { return orderId[a] < orderId[b]; });
+    return assigned;
+}
+
+bool Graph::runWorker(vector<int> &vertices, vector<bool> &top, FILE *in, FILE *out, string partPath)
+{
+    // down-top: contributions to the top part are shipped, the others stay in the subtrees
+    for (auto &v : vertices)
+    {
+        int poiV = checkPOI(v);
+        trees[v].list.compensate(v, poiV, n, k);
+        for (auto &u : trees[v].neighbors)
+        {
+            auto list = IndexList::join(u, shortcuts[v][u], trees[v].list, poiV, n, k);
+            if (top[u])
+            {
+                fwrite(&u, sizeof(u), 1, out);
+                fwrite(&orderId[v], sizeof(int), 1, out);
+                list.write(out);
+            }
+            else
+                trees[u].list.combine(u, move(list), n, k);
+        }
+    }
+    // the error indicator of a stream is sticky, so a failed write shows up at the flush
+    int end = 0;
+    fwrite(&end, sizeof(end), 1, out);
+    if (fflush(out) || ferror(out))
+        return false;
+
+    // receive the complete index of the top vertices read by the subtrees,
+    // the end of the pipe before the end marker means the coordinator is gone
+    int u;
+    while (true)
+    {
+        if (fread(&u, sizeof(u), 1, in) != 1)
+            return false;
+        if (!u)
+            break;
+        trees[u].list.read(in);
+        if (ferror(in) || feof(in))
+            return false;
+    }
+
+    for (auto it = vertices.rbegin(); it != vertices.rend(); it++)
+    {
+        int v = *it;
+        for (auto &u : trees[v].neighbors)
+        {
+            int poiU = checkPOI(u);
+            trees[v].list.combine(v, IndexList::join(v, shortcuts[v][u], trees[u].list, poiU, n, k), n, k);
+        }
+        int poiV = checkPOI(v);
+        trees[v].list.compensate(v, poiV, n, k);
+    }
+
+    // write the partial index and report where each record is
+    FILE *part = fopen(partPath.c_str(), "wb");
+    if (!part)
+    {
+        cerr << "Failed to open file: " << partPath << "\n";
+        return false;
+    }
+    for (auto &v : vertices)
+    {
+        long offset = ftell(part);
+        trees[v].list.write(part);
+        fwrite(&v, sizeof(v), 1, out);
+        fwrite(&offset, sizeof(offset), 1, out);
+    }
+    // without the end marker the coordinator sees the failure as a broken pipe
+    bool written = !ferror(part);
+    written = !fclose(part) && written;
+    if (!written)
+    {
+        cerr << "Failed to write file: " << partPath << "\n";
+        return false;
+    }
+    fwrite(&end, sizeof(end), 1, out);
+    return !fflush(out) && !ferror(out);
+}
+
+bool Graph::buildDistributedIndex(string indexPath, int workers)
+{
+    auto start = chrono::high_resolution_clock::now();
+    // a worker that dies closes its pipe, writing to it then fails with EPIPE instead of killing the coordinator
+    signal(SIGPIPE, SIG_IGN);
+
+    treeDecomposition();
+    refine();
+
+    vector<bool> top;
+    auto assigned = splitSubtrees(workers, top);
+    printf("top part:%ld vertices\n", count(top.begin(), top.end(), true));
+    for (int w = 0; w < workers; w++)
+        printf("worker %d:%ld vertices\n", w + 1, assigned[w].size());
+
+    // part 0 holds the top part, part w the subtrees of worker w
+    vector<string> parts = {indexPath + ".part0"};
+    vector<pid_t> pids;
+    vector<FILE *> input, output;
+
+    // on the first failure the workers are killed and reaped, and the parts removed
+    auto fail = [&](string message)
+    {
+        cerr << message << "\n";
+        for (auto &pid : pids)
+            if (pid > 0)
+                kill(pid, SIGKILL);
+        for (auto &pid : pids)
+            if (pid > 0)
+                waitpid(pid, nullptr, 0);
+        for (auto &file : input)
+            if (file)
+                fclose(file);
+        for (auto &file : output)
+            if (file)
+                fclose(file);
+        for (auto &path : parts)
+            filesystem::remove(path);
+        return false;
+    };
+
+    for (int w = 0; w < workers; w++)
+    {
+        parts.emplace_back(indexPath + ".part" + to_string(w + 1));
+        int toWorker[2], fromWorker[2];
+        if (pipe(toWorker) || pipe(fromWorker))
+            return fail("Failed to create pipe for worker " + to_string(w + 1));
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0)
+            return fail("Failed to start worker " + to_string(w + 1));
+        if (pid == 0)
+        {
+            for (int i = 0; i < w; i++)
+            {
+                close(fileno(input[i]));
+                close(fileno(output[i]));
+            }
+            close(toWorker[1]);
+            close(fromWorker[0]);
+            FILE *in = fdopen(toWorker[0], "rb");
+            FILE *out = fdopen(fromWorker[1], "wb");
+            bool done = runWorker(assigned[w], top, in, out, parts.back());
+            fclose(in);
+            fclose(out);
+            _exit(done ? 0 : 1);
+        }
+        close(toWorker[0]);
+        close(fromWorker[1]);
+        pids.emplace_back(pid);
+        output.emplace_back(fdopen(toWorker[1], "wb"));
+        input.emplace_back(fdopen(fromWorker[0], "rb"));
+    }
+
+    // boundary contributions of the workers: (top vertex, order id of the contributor, list)
+    // the end of a pipe before the end marker means the worker is gone
+    vector<vector<tuple<int, int, IndexList>>> received(workers);
+    vector<char> broken(workers, false);
+#pragma omp parallel for
+    for (int w = 0; w < workers; w++)
+    {
+        int u, id;
+        while (true)
+        {
+            if (fread(&u, sizeof(u), 1, input[w]) != 1)
+            {
+                broken[w] = true;
+                break;
+            }
+            if (!u)
+                break;
+            IndexList list;
+            if (fread(&id, sizeof(id), 1, input[w]) == 1)
+                list.read(input[w]);
+            if (ferror(input[w]) || feof(input[w]))
+            {
+                broken[w] = true;
+                break;
+            }
+            received[w].emplace_back(u, id, move(list));
+        }
+    }
+    for (int w = 0; w < workers; w++)
+        if (broken[w])
+            return fail("Failed to receive the contributions of worker " + to_string(w + 1));
+
+    // combine the contributions to each top vertex in the order of the sequential down-top pass
+    vector<vector<pair<int, IndexList>>> pending(n + 1);
+    for (auto &lists : received)
+        for (auto &[u, id, list] : lists)
+            pending[u].emplace_back(id, move(list));
+    received.clear();
+
+    printf("start building the index of the top part...\n");
+    for (int id = 1; id <= n; id++)
+    {
+        int v = orderMap[id];
+        if (!top[v])
+            continue;
+        sort(pending[v].begin(), pending[v].end(), [](auto &a, auto &b)
+             { return a.first < b.first; });
+        for (auto &[from, list] : pending[v])
+            trees[v].list.combine(v, move(list), n, k);
+        vector<pair<int, IndexList>>().swap(pending[v]);
+
+        int poiV = checkPOI(v);
+        trees[v].list.compensate(v, poiV, n, k);
+        for (auto &u : trees[v].neighbors)
+            pending[u].emplace_back(id, IndexList::join(u, shortcuts[v][u], trees[v].list, poiV, n, k));
+    }
+    for (int id = n; id; id--)
+    {
+        int v = orderMap[id];
+        if (!top[v])
+            continue;
+        for (auto &u : trees[v].neighbors)
+        {
+            int poiU = checkPOI(u);
+            trees[v].list.combine(v, IndexList::join(v, shortcuts[v][u], trees[u].list, poiU, n, k), n, k);
+        }
+        int poiV = checkPOI(v);
+        trees[v].list.compensate(v, poiV, n, k);
+    }
+
+    // send each worker the top vertices that its subtrees read
+    vector<bool> sent(n + 1);
+    for (int w = 0; w < workers; w++)
+    {
+        fill(sent.begin(), sent.end(), false);
+        for (auto &v : assigned[w])
+            for (auto &u : trees[v].neighbors)
+                if (top[u] && !sent[u])
+                {
+                    sent[u] = true;
+                    fwrite(&u, sizeof(u), 1, output[w]);
+                    trees[u].list.write(output[w]);
+                }
+        int end = 0;
+        fwrite(&end, sizeof(end), 1, output[w]);
+        // fclose flushes the stream, the error indicator covers the earlier writes
+        bool written = !ferror(output[w]);
+        written = !fclose(output[w]) && written;
+        output[w] = nullptr;
+        if (!written)
+            return fail("Failed to send the top part to worker " + to_string(w + 1));
+    }
+
+    vector<pair<int, long>> location(n + 1);
+    FILE *part = fopen(parts[0].c_str(), "wb");
+    if (!part)
+        return fail("Failed to open file: " + parts[0]);
+    for (int v = 1; v <= n; v++)
+        if (top[v])
+        {
+            location[v] = make_pair(0, ftell(part));
+            trees[v].list.write(part);
+        }
+    bool written = !ferror(part);
+    written = !fclose(part) && written;
+    if (!written)
+        return fail("Failed to write file: " + parts[0]);
+
+    for (int w = 0; w < workers; w++)
+    {
+        int v;
+        long offset;
+        while (true)
+        {
+            if (fread(&v, sizeof(v), 1, input[w]) != 1)
+                return fail("Failed to receive the locations of worker " + to_string(w + 1));
+            if (!v)
+                break;
+            if (fread(&offset, sizeof(offset), 1, input[w]) != 1)
+                return fail("Failed to receive the locations of worker " + to_string(w + 1));
+            location[v] = make_pair(w + 1, offset);
+        }
+        fclose(input[w]);
+        input[w] = nullptr;
+        int status;
+        waitpid(pids[w], &status, 0);
+        pids[w] = -1;
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            return fail("Worker " + to_string(w + 1) + " failed");
+    }
+
+    bool assembled = assembleIndex(indexPath, parts, location);
+    for (auto &path : parts)
+        filesystem::remove(path);
+
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> duration = end - start;
+    printf("indexing time:%.2lfs\n", duration.count());
+    return assembled;
+}
@@ -5,6 +5,7 @@ Graph::Graph(string graphPath, int labelSize, int k)
     printf("load graph file...\n");
     this->labelSize = labelSize;
     this->k = k;
+    this->queryK = k;
 
     ifstream fin(graphPath);
 
@@ -27,8 +28,8 @@ Graph::Graph(string graphPath, int labelSize, int k)
     {
         // printf("cnt:%d\n", cnt++);
         uint newLabel = resignLabel(label);
-        edges[u].emplace_back(v, weight, newLabel);
-        edges[v].emplace_back(u, weight, newLabel);
+        edges[u].emplace_back(v, Dist(weight), newLabel);
+        edges[v].emplace_back(u, Dist(weight), newLabel);
         labels.insert(newLabel);
     }
     fin.close();
@@ -148,7 +149,27 @@ void Graph::loadPOI()
         isPOI[v] = true;
 }
 
-int Graph::checkPOI(int v)
+void Graph::loadCategory(string name, string poiPath)
+{
+    printf("load poi file of category %s...\n", name.c_str());
+    POICategory category;
+    category.name = name;
+    category.isPOI.resize(n + 1, false);
+
+    ifstream fin(poiPath);
+    if (!fin)
+    {
+        cerr << "Failed to open file: " << poiPath << endl;
+        exit(1);
+    }
+    int v;
+    while (fin >> v)
+        category.isPOI[v] = true;
+    fin.close();
+    categories.emplace_back(move(category));
+}
+
+int Graph::checkPOI(int v) const
 {
     return isPOI[v] ? v : 0;
 }
@@ -189,37 +210,81 @@ void Graph::storeIndex1(string indexPath)
     fout.close();
 }
 
+// split [1, n] into ranges of about 16MB of records, given the end offset of each record
+static vector<pair<int, int>> splitRecords(vector<uint64_t> &offset, int n)
+{
+    const uint64_t chunk = 1 << 24;
+    vector<pair<int, int>> ranges;
+    int first = 1;
+    for (int v = 1; v <= n; v++)
+        if (v == n || offset[v] - offset[first - 1] >= chunk)
+        {
+            ranges.emplace_back(first, v);
+            first = v + 1;
+        }
+    return ranges;
+}
+
 void Graph::storeIndex2(string indexPath)
 {
     printf("store index file...\n");
-    FILE *ofile = fopen(indexPath.c_str(), "wb");
-    if (!ofile)
+    auto start = chrono::high_resolution_clock::now();
+
+    auto missing = [&](int v)
     {
-        cerr << "Failed to open file: " << indexPath << "\n";
+        return !hasIndex.empty() && !hasIndex[v];
+    };
+    IndexFile::Header header = {{'L', 'C', 'K', 'I'}, 1, n, k, labelSize, int(sizeof(Dist))};
+    vector<uint64_t> offset(n + 1);
+    offset[0] = sizeof(header) + offset.size() * sizeof(uint64_t);
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (int v = 1; v <= n; v++)
+        offset[v] = missing(v) ? sizeof(uint) : trees[v].list.recordSize();
+    for (int v = 1; v <= n; v++)
+        offset[v] += offset[v - 1];
+
+    // write a temporary file and rename it, so the index file is never left half written
+    string tempPath = indexPath + ".tmp";
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        cerr << "Failed to open file: " << tempPath << "\n";
         return;
     }
+    bool flag = pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+    size_t tableSize = offset.size() * sizeof(uint64_t);
+    flag &= pwrite(fd, offset.data(), tableSize, sizeof(header)) == tableSize;
 
-    for (int v = 1; v <= n; ++v)
+    auto ranges = splitRecords(offset, n);
+#pragma omp parallel for schedule(dynamic) reduction(&& : flag)
+    for (int i = 0; i < ranges.size(); i++)
     {
-        uint cnt = trees[v].list.list.size();
-        fwrite(&cnt, sizeof(cnt), 1, ofile);
-
-        for (auto &[s, knn] : trees[v].list.list)
-        {
-            int label = s.getLabels();
-            uint knn_size = knn.list.size();
-            fwrite(&label, sizeof(label), 1, ofile);
-            fwrite(&knn_size, sizeof(knn_size), 1, ofile);
-
-            for (auto &[d, v] : knn.list)
+        auto [first, last] = ranges[i];
+        vector<char> buffer(offset[last] - offset[first - 1]);
+        char *p = buffer.data();
+        for (int v = first; v <= last; v++)
+            if (missing(v))
             {
-                fwrite(&d, sizeof(d), 1, ofile);
-                fwrite(&v, sizeof(v), 1, ofile);
+                memcpy(p, &IndexList::missing, sizeof(uint));
+                p += sizeof(uint);
             }
-        }
+            else
+                p = trees[v].list.encode(p);
+        if (pwrite(fd, buffer.data(), buffer.size(), offset[first - 1]) != buffer.size())
+            flag = false;
+    }
+    close(fd);
+    if (!flag)
+    {
+        cerr << "Failed to write file: " << tempPath << "\n";
+        filesystem::remove(tempPath);
+        return;
     }
+    filesystem::rename(tempPath, indexPath);
 
-    fclose(ofile);
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> duration = end - start;
+    printf("store throughput:%.2lfMB/s (%.2lfMB in %.3lfs)\n", offset[n] / 1024.0 / 1024.0 / duration.count(), offset[n] / 1024.0 / 1024.0, duration.count());
 }
 
 void Graph::loadIndex1(string indexPath)
@@ -241,7 +306,7 @@ void Graph::loadIndex1(string indexPath)
             knn.reserve(sum);
             while (sum--)
             {
-                double d;
+                Dist d;
                 int u;
                 fin >> d >> u;
                 knn.emplace_back(d, u);
@@ -255,6 +320,63 @@ void Graph::loadIndex1(string indexPath)
 void Graph::loadIndex2(string indexPath)
 {
     printf("load index file...\n");
+    auto start = chrono::high_resolution_clock::now();
+
+    IndexFile file;
+    if (!file.open(indexPath))
+    {
+        loadSequentialIndex(indexPath);
+        return;
+    }
+    if (file.header.n != n || file.header.k != k || file.header.labelSize != labelSize || file.header.distSize != sizeof(Dist))
+    {
+        cerr << "Index does not match the graph or parameters: " << indexPath << "\n";
+        file.close();
+        return;
+    }
+
+    auto ranges = splitRecords(file.offset, n);
+    vector<char> present(n + 1, true);
+    bool flag = true;
+#pragma omp parallel for schedule(dynamic) reduction(&& : flag)
+    for (int i = 0; i < ranges.size(); i++)
+    {
+        auto [first, last] = ranges[i];
+        vector<char> buffer(file.offset[last] - file.offset[first - 1]);
+        if (pread(file.fd, buffer.data(), buffer.size(), file.offset[first - 1]) != buffer.size())
+        {
+            flag = false;
+            continue;
+        }
+        const char *p = buffer.data();
+        for (int v = first; v <= last; v++)
+        {
+            present[v] = trees[v].list.decode(p) != nullptr;
+            p = buffer.data() + (file.offset[v] - file.offset[first - 1]);
+            if (checkPOI(v))
+                for (auto &[s, knn] : trees[v].list.list)
+                    if (knn.size() == k)
+                        knn.list.resize(k - 1);
+        }
+    }
+    file.close();
+    if (!flag)
+    {
+        cerr << "Failed to read file: " << indexPath << "\n";
+        return;
+    }
+
+    hasIndex.clear();
+    if (count(present.begin() + 1, present.end(), false))
+        hasIndex.assign(present.begin(), present.end());
+
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> duration = end - start;
+    printf("load throughput:%.2lfMB/s (%.2lfMB in %.3lfs)\n", file.offset[n] / 1024.0 / 1024.0 / duration.count(), file.offset[n] / 1024.0 / 1024.0, duration.count());
+}
+
+void Graph::loadSequentialIndex(string indexPath)
+{
     FILE *ifile = fopen(indexPath.c_str(), "rb");
     if (!ifile)
     {
@@ -262,40 +384,930 @@ void Graph::loadIndex2(string indexPath)
         return;
     }
 
+    hasIndex.clear();
     for (int v = 1; v <= n; ++v)
     {
-        uint p;
-        fread(&p, sizeof(p), 1, ifile);
+        if (!trees[v].list.read(ifile))
+        {
+            if (hasIndex.empty())
+                hasIndex.assign(n + 1, true);
+            hasIndex[v] = false;
+        }
 
-        auto &index = trees[v].list.list;
-        index.reserve(p);
+        if (checkPOI(v))
+            for (auto &[s, knn] : trees[v].list.list)
+                if (knn.size() == k)
+                    knn.list.resize(k - 1);
+    }
 
-        for (int i = 0; i < p; i++)
+    fclose(ifile);
+}
+
+uint64_t Graph::poiHash() const
+{
+    // FNV-1a over the POI ids
+    uint64_t h = 14695981039346656037ull;
+    for (int v = 1; v <= n; v++)
+        if (isPOI[v])
         {
-            uint labels, nums;
-            fread(&labels, sizeof(labels), 1, ifile);
-            fread(&nums, sizeof(nums), 1, ifile);
+            h ^= uint64_t(v);
+            h *= 1099511628211ull;
+        }
+    return h;
+}
 
-            vector<PDI> knn;
-            knn.reserve(nums);
+vector<int> Graph::checkpointHeader() const
+{
+    uint64_t h = poiHash();
+    return {n, m, k, labelSize, int(sizeof(Dist)), int(h), int(h >> 32)};
+}
+
+// check that a checkpoint belongs to the same graph, POI and build parameters
+static bool checkHeader(FILE *ifile, vector<int> header, string path)
+{
+    vector<int> stored(header.size());
+    if (fread(stored.data(), sizeof(int), stored.size(), ifile) != stored.size() || stored != header)
+    {
+        cerr << "Checkpoint does not match the graph, POI or parameters: " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+void Graph::storeDecomposition(string path)
+{
+    printf("store tree decomposition...\n");
+    filesystem::create_directories(checkpointFolder);
+    string tempPath = path + ".tmp";
+    FILE *ofile = fopen(tempPath.c_str(), "wb");
+    if (!ofile)
+    {
+        cerr << "Failed to open file: " << tempPath << "\n";
+        return;
+    }
 
-            for (int j = 0; j < nums; j++)
+    bool flag = true;
+    auto put = [&](const void *data, size_t size, size_t count)
+    {
+        flag &= fwrite(data, size, count, ofile) == count;
+    };
+    vector<int> header = checkpointHeader();
+    put(header.data(), sizeof(int), header.size());
+    put(orderId.data(), sizeof(int), n + 1);
+    put(orderMap.data(), sizeof(int), n + 1);
+    for (int v = 1; v <= n; v++)
+    {
+        auto &tree = trees[v];
+        uint size = tree.neighbors.size();
+        put(&tree.parent, sizeof(int), 1);
+        put(&size, sizeof(size), 1);
+        put(tree.neighbors.data(), sizeof(int), size);
+        size = tree.children.size();
+        put(&size, sizeof(size), 1);
+        put(tree.children.data(), sizeof(int), size);
+
+        size = shortcuts[v].size();
+        put(&size, sizeof(size), 1);
+        for (auto &[u, shortcut] : shortcuts[v])
+        {
+            uint attrs = shortcut.attrs.size();
+            put(&u, sizeof(u), 1);
+            put(&attrs, sizeof(attrs), 1);
+            for (auto &[d, s] : shortcut.attrs)
             {
-                double dist;
-                int u;
-                fread(&dist, sizeof(dist), 1, ifile);
-                fread(&u, sizeof(u), 1, ifile);
-                knn.emplace_back(dist, u);
+                put(&d, sizeof(d), 1);
+                put(&s.labels, sizeof(s.labels), 1);
+            }
+        }
+    }
+    // fclose flushes the buffered writes, which fail there on a full disk
+    flag &= fclose(ofile) == 0;
+    if (!flag)
+    {
+        cerr << "Failed to write file: " << tempPath << "\n";
+        filesystem::remove(tempPath);
+        return;
+    }
+    filesystem::rename(tempPath, path);
+}
+
+// a short read means a truncated file, which is rejected so the build starts from scratch
+bool Graph::loadDecomposition(string path)
+{
+    FILE *ifile = fopen(path.c_str(), "rb");
+    if (!ifile)
+        return false;
+    printf("load tree decomposition...\n");
+    if (!checkHeader(ifile, checkpointHeader(), path))
+    {
+        fclose(ifile);
+        return false;
+    }
+
+    auto get = [&](void *data, size_t size, size_t count)
+    {
+        return fread(data, size, count, ifile) == count;
+    };
+    clear();
+    bool flag = get(orderId.data(), sizeof(int), n + 1) && get(orderMap.data(), sizeof(int), n + 1);
+    shortcuts.assign(n + 1, map<int, SCAttr>());
+    for (int v = 1; v <= n && flag; v++)
+    {
+        auto &tree = trees[v];
+        uint size;
+        if (!(flag = get(&tree.parent, sizeof(int), 1) && get(&size, sizeof(size), 1)))
+            break;
+        tree.neighbors.resize(size);
+        tree.width = size;
+        if (!(flag = get(tree.neighbors.data(), sizeof(int), size) && get(&size, sizeof(size), 1)))
+            break;
+        tree.children.resize(size);
+        if (!(flag = get(tree.children.data(), sizeof(int), size) && get(&size, sizeof(size), 1)))
+            break;
+
+        while (flag && size--)
+        {
+            int u;
+            uint attrs;
+            if (!(flag = get(&u, sizeof(u), 1) && get(&attrs, sizeof(attrs), 1)))
+                break;
+            auto &shortcut = shortcuts[v][u];
+            shortcut.attrs.reserve(attrs);
+            while (attrs--)
+            {
+                Dist d;
+                uint labels;
+                if (!(flag = get(&d, sizeof(d), 1) && get(&labels, sizeof(labels), 1)))
+                    break;
+                shortcut.attrs.emplace_back(d, LabelSet(labels));
             }
+        }
+    }
+    fclose(ifile);
+    if (!flag)
+    {
+        // the decomposition reads a zero order id as a vertex not yet reduced
+        cerr << "Failed to read file: " << path << "\n";
+        clear();
+        orderId.assign(n + 1, 0);
+        orderMap.assign(n + 1, 0);
+        shortcuts.clear();
+        return false;
+    }
+    return true;
+}
 
-            if (checkPOI(v) && knn.size() == k)
-                knn.resize(k - 1);
+void Graph::storeCheckpoint(int pass, int id)
+{
+    printf("store checkpoint of pass %d at order %d...\n", pass, id);
+    string path = checkpointFolder + "/checkpoint.bin";
+    string tempPath = path + ".tmp";
+    FILE *ofile = fopen(tempPath.c_str(), "wb");
+    if (!ofile)
+    {
+        cerr << "Failed to open file: " << tempPath << "\n";
+        return;
+    }
+
+    vector<int> header = checkpointHeader();
+    bool flag = fwrite(header.data(), sizeof(int), header.size(), ofile) == header.size();
+    flag &= fwrite(&pass, sizeof(pass), 1, ofile) == 1;
+    flag &= fwrite(&id, sizeof(id), 1, ofile) == 1;
+    for (int v = 1; v <= n; v++)
+        trees[v].list.write(ofile);
+    // the error indicator of the stream covers the writes of the lists
+    flag &= !ferror(ofile);
+    flag &= fclose(ofile) == 0;
+    if (!flag)
+    {
+        // keep the previous checkpoint
+        cerr << "Failed to write file: " << tempPath << "\n";
+        filesystem::remove(tempPath);
+        return;
+    }
+    // replace the previous checkpoint only once the new one is complete
+    filesystem::rename(tempPath, path);
+}
+
+// a short read clears the lists read so far, so the construction restarts after the decomposition
+bool Graph::loadCheckpoint(int &pass, int &id)
+{
+    string path = checkpointFolder + "/checkpoint.bin";
+    FILE *ifile = fopen(path.c_str(), "rb");
+    if (!ifile)
+        return false;
+    printf("load checkpoint...\n");
+    if (!checkHeader(ifile, checkpointHeader(), path))
+    {
+        fclose(ifile);
+        return false;
+    }
+
+    int storedPass, storedId;
+    bool flag = fread(&storedPass, sizeof(storedPass), 1, ifile) == 1 && fread(&storedId, sizeof(storedId), 1, ifile) == 1;
+    for (int v = 1; v <= n && flag; v++)
+    {
+        trees[v].list.read(ifile);
+        flag = !ferror(ifile) && !feof(ifile);
+    }
+    fclose(ifile);
+    if (!flag)
+    {
+        cerr << "Failed to read file: " << path << "\n";
+        for (int v = 1; v <= n; v++)
+            trees[v].list.list.clear();
+        return false;
+    }
+    pass = storedPass;
+    id = storedId;
+    return true;
+}
 
-            index.emplace_back(labels, move(knn));
+void Graph::shrinkIndex(int k)
+{
+    printf("shrink index from k=%d to k=%d...\n", this->k, k);
+    if (k > this->k)
+    {
+        printf("the index can only be shrunk to a smaller k\n");
+        return;
+    }
+    // the knn of each label set in the index of a larger k starts with the knn for k,
+    // so compensating again with k keeps exactly the entries of an index built for k
+    for (int v = 1; v <= n; v++)
+        trees[v].list.compensate(v, checkPOI(v), n, k);
+    this->k = k;
+    queryK = min(queryK, k);
+}
+
+void Graph::shareIndex()
+{
+    printf("share knn payloads of the index...\n");
+    LL before = 0;
+    LL after = 0;
+    LL references = 0;
+    sharedList.assign(n + 1, {});
+    for (int v = 1; v <= n; v++)
+    {
+        before += trees[v].list.bytes();
+        auto &entries = sharedList[v];
+        entries.reserve(trees[v].list.list.size());
+        for (auto &[s, knn] : trees[v].list.list)
+        {
+            auto [base, p] = knnPool.intern(knn.list);
+            entries.emplace_back(s, base, p);
+            references++;
         }
+        after += entries.capacity() * sizeof(entries[0]);
+        vector<pair<LabelSet, KNNList>>().swap(trees[v].list.list);
+    }
+    unordered_map<size_t, vector<uint>>().swap(knnPool.buckets);
+    after += knnPool.bytes();
+    shared = true;
+
+    printf("knn payloads:%lld, distinct payloads:%ld, deduplication ratio:%.2lf\n", references, knnPool.payloads(), knnPool.payloads() ? double(references) / knnPool.payloads() : 0.0);
+    printf("index memory:%.2lfMB -> %.2lfMB, saved %.2lf%%\n", before / 1024.0 / 1024.0, after / 1024.0 / 1024.0, before ? 100.0 * (before - after) / before : 0.0);
+}
+
+void Graph::restoreIndex()
+{
+    if (shared)
+    {
+        for (int v = 1; v <= n; v++)
+        {
+            auto &list = trees[v].list.list;
+            list.reserve(sharedList[v].size());
+            for (auto &[s, base, p] : sharedList[v])
+                list.emplace_back(s, knnPool.decode(base, p));
+        }
+        vector<vector<tuple<LabelSet, Dist, uint>>>().swap(sharedList);
+        knnPool = KNNPool();
+        shared = false;
+    }
+    // a derived vertex only reads stored neighbors, so the order of deriving does not matter
+    if (!derived.empty())
+    {
+        for (int v = 1; v <= n; v++)
+            if (derived[v])
+                trees[v].list = deriveIndex(v);
+        derived.clear();
+    }
+}
+
+// the CSR layout holds the full index, so shared and derived vertices are restored first
+void Graph::freeze()
+{
+    printf("freeze index...\n");
+    restoreIndex();
+    LL before = 0;
+    for (int v = 1; v <= n; v++)
+        before += trees[v].list.bytes();
+    frozenIndex.build(trees, n);
+    for (int v = 1; v <= n; v++)
+        vector<pair<LabelSet, KNNList>>().swap(trees[v].list.list);
+    frozen = true;
+    printf("index memory:%.2lfMB -> %.2lfMB\n", before / 1024.0 / 1024.0, frozenIndex.bytes() / 1024.0 / 1024.0);
+}
+
+void Graph::thaw()
+{
+    printf("thaw index...\n");
+    for (int v = 1; v <= n; v++)
+        trees[v].list = frozenIndex.thaw(v);
+    frozenIndex.clearData();
+    frozenIndex.unmap();
+    frozenIndex = FrozenIndex();
+    frozen = false;
+}
+
+void Graph::storeFrozenIndex(string indexPath)
+{
+    printf("store frozen index file...\n");
+    FILE *ofile = fopen(indexPath.c_str(), "wb");
+    if (!ofile)
+    {
+        cerr << "Failed to open file: " << indexPath << "\n";
+        return;
+    }
+    auto &index = frozenIndex;
+    uint64_t entries = index.entryOffset[n + 1];
+    FrozenIndex::Header header = {{'L', 'C', 'K', 'F'}, 1, n, k, labelSize, int(sizeof(Dist)), entries, index.knnOffset[entries]};
+    auto offset = FrozenIndex::layout(n, header.entries, header.items);
+
+    vector<char> padding(64, 0);
+    auto put = [&](const void *data, size_t size, size_t start)
+    {
+        fwrite(padding.data(), 1, start - ftell(ofile), ofile);
+        fwrite(data, 1, size, ofile);
+    };
+    fwrite(&header, sizeof(header), 1, ofile);
+    put(index.entryOffset, (n + 2) * sizeof(uint), offset[0]);
+    put(index.labels, header.entries * sizeof(uint), offset[1]);
+    put(index.knnOffset, (header.entries + 1) * sizeof(uint64_t), offset[2]);
+    put(index.dist, header.items * sizeof(Dist), offset[3]);
+    put(index.vertex, header.items * sizeof(int), offset[4]);
+    fclose(ofile);
+}
+
+bool Graph::mapFrozenIndex(string indexPath, bool willNeed, bool hugePages)
+{
+    printf("map frozen index file...\n");
+    int fd = open(indexPath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        cerr << "Failed to open file: " << indexPath << "\n";
+        return false;
     }
+    struct stat st;
+    fstat(fd, &st);
+    void *mapping = st.st_size >= sizeof(FrozenIndex::Header) ? mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        cerr << "Failed to map file: " << indexPath << "\n";
+        return false;
+    }
+
+    auto &header = *(const FrozenIndex::Header *)mapping;
+    auto offset = FrozenIndex::layout(n, header.entries, header.items);
+    if (memcmp(header.magic, "LCKF", 4) || header.version != 1 || header.n != n || header.k != k || header.labelSize != labelSize || header.distSize != sizeof(Dist) || offset[5] > st.st_size)
+    {
+        cerr << "Frozen index does not match the graph or parameters: " << indexPath << "\n";
+        munmap(mapping, st.st_size);
+        return false;
+    }
+    if (willNeed)
+        madvise(mapping, st.st_size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    if (hugePages)
+        madvise(mapping, st.st_size, MADV_HUGEPAGE);
+#endif
 
+    auto &index = frozenIndex;
+    index.clearData();
+    index.unmap();
+    index.mapping = mapping;
+    index.mappingSize = st.st_size;
+    index.n = n;
+    char *base = (char *)mapping;
+    index.entryOffset = (const uint *)(base + offset[0]);
+    index.labels = (const uint *)(base + offset[1]);
+    index.knnOffset = (const uint64_t *)(base + offset[2]);
+    index.dist = (const Dist *)(base + offset[3]);
+    index.vertex = (const int *)(base + offset[4]);
+    for (int v = 1; v <= n; v++)
+        vector<pair<LabelSet, KNNList>>().swap(trees[v].list.list);
+    frozen = true;
+    return true;
+}
+
+// as freeze, the encoding holds the full index
+void Graph::compressIndex()
+{
+    printf("compress index...\n");
+    restoreIndex();
+    LL before = 0;
+    for (int v = 1; v <= n; v++)
+        before += trees[v].list.bytes();
+    compressedIndex.build(trees, n);
+    for (int v = 1; v <= n; v++)
+        vector<pair<LabelSet, KNNList>>().swap(trees[v].list.list);
+    compressed = true;
+    printf("label masks:%ld, label bits:%d, vertex bits:%d, varint distances:%s\n", compressedIndex.dictionary.size(), compressedIndex.labelBits, compressedIndex.idBits, compressedIndex.integral ? "yes" : "no");
+    printf("index memory:%.2lfMB -> %.2lfMB\n", before / 1024.0 / 1024.0, compressedIndex.bytes() / 1024.0 / 1024.0);
+}
+
+template <class T>
+static void writeVector(FILE *ofile, const vector<T> &data)
+{
+    uint64_t size = data.size();
+    fwrite(&size, sizeof(size), 1, ofile);
+    fwrite(data.data(), sizeof(T), size, ofile);
+}
+
+template <class T>
+static bool readVector(FILE *ifile, vector<T> &data)
+{
+    uint64_t size;
+    if (fread(&size, sizeof(size), 1, ifile) != 1)
+        return false;
+    data.resize(size);
+    return fread(data.data(), sizeof(T), size, ifile) == size;
+}
+
+void Graph::storeCompressedIndex(string indexPath)
+{
+    printf("store compressed index file...\n");
+    FILE *ofile = fopen(indexPath.c_str(), "wb");
+    if (!ofile)
+    {
+        cerr << "Failed to open file: " << indexPath << "\n";
+        return;
+    }
+    auto &index = compressedIndex;
+    vector<int> header = {n, k, labelSize, int(sizeof(Dist)), index.integral, index.idBits, index.labelBits};
+    fwrite(header.data(), sizeof(int), header.size(), ofile);
+    writeVector(ofile, index.dictionary);
+    writeVector(ofile, index.entryOffset);
+    writeVector(ofile, index.itemOffset);
+    writeVector(ofile, index.byteOffset);
+    writeVector(ofile, index.labelIds);
+    writeVector(ofile, index.counts);
+    writeVector(ofile, index.sizes);
+    writeVector(ofile, index.ids);
+    writeVector(ofile, index.deltas);
+    writeVector(ofile, index.raw);
+    fclose(ofile);
+}
+
+void Graph::loadCompressedIndex(string indexPath)
+{
+    printf("load compressed index file...\n");
+    FILE *ifile = fopen(indexPath.c_str(), "rb");
+    if (!ifile)
+    {
+        cerr << "Failed to open file: " << indexPath << "\n";
+        return;
+    }
+    auto &index = compressedIndex;
+    index = CompressedIndex();
+    vector<int> header(7);
+    bool flag = fread(header.data(), sizeof(int), header.size(), ifile) == header.size() && header[0] == n && header[1] == k && header[2] == labelSize && header[3] == sizeof(Dist);
+    if (flag)
+    {
+        index.n = n;
+        index.integral = header[4];
+        index.idBits = header[5];
+        index.labelBits = header[6];
+        flag = readVector(ifile, index.dictionary) && readVector(ifile, index.entryOffset) && readVector(ifile, index.itemOffset) && readVector(ifile, index.byteOffset) && readVector(ifile, index.labelIds) && readVector(ifile, index.counts) && readVector(ifile, index.sizes) && readVector(ifile, index.ids) && readVector(ifile, index.deltas) && readVector(ifile, index.raw);
+    }
     fclose(ifile);
+    if (!flag)
+    {
+        cerr << "Compressed index does not match the graph or parameters: " << indexPath << "\n";
+        index = CompressedIndex();
+        return;
+    }
+    compressed = true;
+}
+
+bool Graph::openTieredIndex(string indexPath, size_t budget)
+{
+    tierFile.close();
+    if (!tierFile.open(indexPath))
+    {
+        cerr << "Failed to open index file with offset table: " << indexPath << "\n";
+        return false;
+    }
+    auto &header = tierFile.header;
+    if (header.n != n || header.k != k || header.labelSize != labelSize || header.distSize != sizeof(Dist))
+    {
+        cerr << "Index does not match the graph or parameters: " << indexPath << "\n";
+        tierFile.close();
+        return false;
+    }
+
+    // every list now lives on disk until it is queried
+    for (int v = 1; v <= n; v++)
+        vector<pair<LabelSet, KNNList>>().swap(trees[v].list.list);
+    hasIndex.clear();
+    tiered = true;
+    tierCache.init(n, budget);
+    diskReads = diskBytes = prefetched = 0;
+    printf("index file on disk:%.2lfMB, memory budget:%.2lfMB\n", tierFile.offset[n] / 1024.0 / 1024.0, budget / 1024.0 / 1024.0);
+    return true;
+}
+
+bool Graph::readTieredIndex(int v)
+{
+    diskReads++;
+    diskBytes += tierFile.offset[v] - tierFile.offset[v - 1];
+    if (!tierFile.read(v, trees[v].list))
+    {
+        // a vertex without index in a partial index is answered by dijkstra from now on
+        if (hasIndex.empty())
+            hasIndex.assign(n + 1, true);
+        hasIndex[v] = false;
+        return false;
+    }
+    if (checkPOI(v))
+        for (auto &[s, knn] : trees[v].list.list)
+            if (knn.size() == k)
+                knn.list.resize(k - 1);
+    tierCache.insert(v, trees[v].list.bytes());
+    return true;
+}
+
+void Graph::evictTieredIndex()
+{
+    // the most recently used index is kept even if it alone exceeds the budget
+    while (tierCache.bytes > tierCache.budget && tierCache.order.size() > 1)
+    {
+        int u = tierCache.order.back();
+        tierCache.order.pop_back();
+        tierCache.cached[u] = false;
+        tierCache.bytes -= trees[u].list.bytes();
+        tierCache.evictions++;
+        vector<pair<LabelSet, KNNList>>().swap(trees[u].list.list);
+    }
+}
+
+bool Graph::fetch(int v)
+{
+    if (tierCache.cached[v])
+    {
+        tierCache.hits++;
+        tierCache.touch(v);
+        return true;
+    }
+    tierCache.misses++;
+    if (!readTieredIndex(v))
+        return false;
+    evictTieredIndex();
+    return true;
+}
+
+void Graph::prefetch(vector<int> &vertices)
+{
+    vector<int> pending;
+    for (auto &v : vertices)
+        if (!tierCache.cached[v] && (hasIndex.empty() || hasIndex[v]))
+            pending.emplace_back(v);
+    sort(pending.begin(), pending.end(), [&](int a, int b)
+         { return tierFile.offset[a] < tierFile.offset[b]; });
+    pending.erase(unique(pending.begin(), pending.end()), pending.end());
+
+    // read ahead at most half of the budget, so the batch does not evict itself
+    size_t bytes = 0;
+    for (auto &v : pending)
+    {
+        if (bytes > tierCache.budget / 2)
+            break;
+        if (readTieredIndex(v))
+        {
+            prefetched++;
+            bytes += trees[v].list.bytes();
+        }
+    }
+    evictTieredIndex();
+}
+
+void Graph::reportTieredIndex()
+{
+    LL sum = tierCache.hits + tierCache.misses;
+    printf("tiered index hits:%lld, misses:%lld, hit rate:%.2lf%%\n", tierCache.hits, tierCache.misses, sum ? 100.0 * tierCache.hits / sum : 0.0);
+    printf("tiered index disk reads:%lld (%lld prefetched), read:%.2lfMB, evictions:%lld\n", diskReads, prefetched, diskBytes / 1024.0 / 1024.0, tierCache.evictions);
+    printf("tiered index cached vertices:%ld, cached memory:%.2lfMB\n", tierCache.order.size(), tierCache.bytes / 1024.0 / 1024.0);
+}
+
+vector<bool> Graph::regionAround(vector<int> &seeds, int radius)
+{
+    vector<bool> inside(n + 1, false);
+    vector<int> frontier;
+    for (auto &v : seeds)
+        if (v >= 1 && v <= n && !inside[v])
+        {
+            inside[v] = true;
+            frontier.emplace_back(v);
+        }
+    for (int hop = 0; hop < radius && !frontier.empty(); hop++)
+    {
+        vector<int> next;
+        for (auto &v : frontier)
+            for (auto &edge : edges[v])
+                if (!inside[edge.target])
+                {
+                    inside[edge.target] = true;
+                    next.emplace_back(edge.target);
+                }
+        frontier.swap(next);
+    }
+    return inside;
+}
+
+vector<bool> Graph::regionInBox(string coordinatePath, double x1, double y1, double x2, double y2)
+{
+    vector<bool> inside(n + 1, false);
+    ifstream fin(coordinatePath);
+    if (!fin)
+    {
+        cerr << "Failed to open file: " << coordinatePath << "\n";
+        return inside;
+    }
+    // lines of the form "v id x y", other lines are comments and the problem line
+    string line;
+    while (getline(fin, line))
+    {
+        if (line.empty() || line[0] != 'v')
+            continue;
+        stringstream ss(line.substr(1));
+        int v;
+        double x, y;
+        if (ss >> v >> x >> y && v >= 1 && v <= n)
+            inside[v] = x >= x1 && x <= x2 && y >= y1 && y <= y2;
+    }
+    fin.close();
+    return inside;
+}
+
+bool Graph::loadRegionIndex(string indexPath, vector<bool> &region)
+{
+    printf("load index file of the region...\n");
+    auto start = chrono::high_resolution_clock::now();
+
+    IndexFile file;
+    if (!file.open(indexPath))
+    {
+        cerr << "Failed to open index file with offset table: " << indexPath << "\n";
+        return false;
+    }
+    auto &header = file.header;
+    if (header.n != n || header.k != k || header.labelSize != labelSize || header.distSize != sizeof(Dist))
+    {
+        cerr << "Index does not match the graph or parameters: " << indexPath << "\n";
+        file.close();
+        return false;
+    }
+
+    vector<int> vertices;
+    for (int v = 1; v <= n; v++)
+    {
+        vector<pair<LabelSet, KNNList>>().swap(trees[v].list.list);
+        if (region[v])
+            vertices.emplace_back(v);
+    }
+
+    // records of the region are read one by one, so the load touches only their pages
+    vector<char> present(n + 1, true);
+    LL bytes = 0, diskBytes = 0;
+#pragma omp parallel for schedule(dynamic, 64) reduction(+ : bytes, diskBytes)
+    for (int i = 0; i < vertices.size(); i++)
+    {
+        int v = vertices[i];
+        present[v] = file.read(v, trees[v].list);
+        if (checkPOI(v))
+            for (auto &[s, knn] : trees[v].list.list)
+                if (knn.size() == k)
+                    knn.list.resize(k - 1);
+        bytes += trees[v].list.bytes();
+        diskBytes += file.offset[v] - file.offset[v - 1];
+    }
+    file.close();
+
+    hasIndex.clear();
+    if (count(present.begin() + 1, present.end(), false))
+        hasIndex.assign(present.begin(), present.end());
+    this->region = region;
+    queryContext.regionMisses = 0;
+
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> duration = end - start;
+    printf("region vertices:%ld of %d (%.2lf%%)\n", vertices.size(), n, 100.0 * vertices.size() / n);
+    printf("region index read:%.2lfMB of %.2lfMB, memory:%.2lfMB, load time:%.3lfs\n", diskBytes / 1024.0 / 1024.0, file.offset[n] / 1024.0 / 1024.0, bytes / 1024.0 / 1024.0, duration.count());
+    return true;
+}
+
+void Graph::reportRegion()
+{
+    printf("queries outside the region:%lld\n", queryContext.regionMisses);
+}
+
+IndexList Graph::deriveIndex(int v) const
+{
+    IndexList list;
+    for (auto &u : trees[v].neighbors)
+    {
+        int poiU = checkPOI(u);
+        if (shared)
+        {
+            // the lists of the neighbors live in the knn pool once the index is shared
+            IndexList neighbor;
+            for (auto &[s, base, p] : sharedList[u])
+                neighbor.list.emplace_back(s, knnPool.decode(base, p));
+            list.combine(v, IndexList::join(v, shortcuts[v].at(u), neighbor, poiU, n, k), n, k);
+        }
+        else
+            list.combine(v, IndexList::join(v, shortcuts[v].at(u), trees[u].list, poiU, n, k), n, k);
+    }
+    list.compensate(v, checkPOI(v), n, k);
+    return list;
+}
+
+void Graph::deriveIndex(int maxWidth, double ratio)
+{
+    printf("derive the index of low-width vertices...\n");
+    derived.assign(n + 1, false);
+    LL before = 0;
+    LL saved = 0;
+    LL readEntries = 0;
+    int count = 0;
+    // ancestors first, so a derived vertex only reads stored neighbors
+    for (int id = n; id; id--)
+    {
+        int v = orderMap[id];
+        auto &list = trees[v].list;
+        before += list.bytes();
+        auto &neighbors = trees[v].neighbors;
+        if (neighbors.empty() || neighbors.size() > maxWidth)
+            continue;
+
+        LL stored = list.entries();
+        LL read = 0;
+        bool flag = true;
+        for (auto &u : neighbors)
+        {
+            flag &= !derived[u];
+            read += trees[u].list.entries();
+        }
+        if (!flag || stored < ratio * read || !(deriveIndex(v) == list))
+            continue;
+
+        derived[v] = true;
+        count++;
+        saved += list.bytes();
+        readEntries += read;
+        vector<pair<LabelSet, KNNList>>().swap(list.list);
+    }
+    printf("derived vertices:%d (%.2lf%%), entries read per derived query:%.2lf\n", count, 100.0 * count / n, count ? double(readEntries) / count : 0.0);
+    printf("index memory:%.2lfMB -> %.2lfMB, saved %.2lf%%\n", before / 1024.0 / 1024.0, (before - saved) / 1024.0 / 1024.0, before ? 100.0 * saved / before : 0.0);
+}
+
+void Graph::approximateIndex(double epsilon)
+{
+    printf("approximate the index with epsilon=%.3lf...\n", epsilon);
+    this->epsilon = epsilon;
+    LL before = 0;
+    LL after = 0;
+
+    for (int v = 1; v <= n; v++)
+    {
+        auto &list = trees[v].list.list;
+        before += list.size();
+
+        // smaller label sets first, so an entry is only replaced by entries that stay in the index
+        vector<int> order(list.size());
+        iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(), [&](int a, int b)
+                    { return list[a].first.size() < list[b].first.size(); });
+
+        // an entry is dropped when every vertex in it is also kept by a subset within (1+epsilon),
+        // so any query including it loses at most a factor (1+epsilon) on each vertex and thus on each rank
+        vector<bool> kept(list.size(), true);
+        unordered_map<int, Dist> nearest;
+        for (auto &i : order)
+        {
+            nearest.clear();
+            for (int j = 0; j < list.size(); j++)
+                if (j != i && kept[j] && list[i].first.includes(list[j].first))
+                    for (auto &[d, w] : list[j].second.list)
+                    {
+                        auto it = nearest.find(w);
+                        if (it == nearest.end() || d < it->second)
+                            nearest[w] = d;
+                    }
+
+            bool flag = true;
+            for (auto &[d, w] : list[i].second.list)
+            {
+                auto it = nearest.find(w);
+                if (it == nearest.end() || double(it->second) > (1 + epsilon) * double(d))
+                {
+                    flag = false;
+                    break;
+                }
+            }
+            if (flag)
+                kept[i] = false;
+        }
+
+        int cnt = 0;
+        for (int i = 0; i < list.size(); i++)
+            if (kept[i])
+            {
+                if (cnt != i)
+                    list[cnt] = move(list[i]);
+                cnt++;
+            }
+        list.resize(cnt);
+        list.shrink_to_fit();
+        after += cnt;
+    }
+    printf("label sets:%lld -> %lld (%.2lf%%)\n", before, after, before ? 100.0 * after / before : 0.0);
+}
+
+void Graph::pruneIndex(string profilePath)
+{
+    printf("prune the index to the profile %s...\n", profilePath.c_str());
+    ifstream fin(profilePath);
+    if (!fin)
+    {
+        cerr << "Failed to open file: " << profilePath << endl;
+        return;
+    }
+    profileMask.assign(1u << labelSize, false);
+    int v;
+    string labels;
+    set<uint> masks;
+    int ignored = 0;
+    while (fin >> v >> labels)
+    {
+        uint mask = LabelSet(labels).getLabels();
+        // the graph has no edges with labels beyond labelSize
+        if (mask >= profileMask.size())
+        {
+            ignored++;
+            continue;
+        }
+        masks.insert(mask);
+        profileMask[mask] = true;
+    }
+    fin.close();
+    if (ignored)
+        printf("profile queries with labels beyond the %d labels of the graph:%d, ignored\n", labelSize, ignored);
+
+    // a query is answered by the entries of its subsets, so close the profile downwards
+    for (int i = 0; i < labelSize; i++)
+        for (uint mask = 0; mask < profileMask.size(); mask++)
+            if ((mask >> i & 1) && profileMask[mask])
+                profileMask[mask ^ (1u << i)] = true;
+    LL covered = count(profileMask.begin(), profileMask.end(), true);
+
+    LL labelBefore = 0, labelAfter = 0;
+    LL indexBefore = 0, indexAfter = 0;
+    for (int v = 1; v <= n; v++)
+    {
+        auto &list = trees[v].list.list;
+        labelBefore += list.size();
+        indexBefore += trees[v].list.entries();
+        int cnt = 0;
+        for (int i = 0; i < list.size(); i++)
+            if (inProfile(list[i].first.getLabels()))
+            {
+                if (cnt != i)
+                    list[cnt] = move(list[i]);
+                cnt++;
+            }
+        list.resize(cnt);
+        list.shrink_to_fit();
+        labelAfter += cnt;
+        indexAfter += trees[v].list.entries();
+    }
+    double sizeBefore = (n * 4 + labelBefore * 4 + indexBefore * 8) / 1024 / 1024.0;
+    double sizeAfter = (n * 4 + labelAfter * 4 + indexAfter * 8) / 1024 / 1024.0;
+    printf("profile masks:%ld, covered masks:%lld of %ld (%.2lf%%)\n", masks.size(), covered, profileMask.size(), 100.0 * covered / profileMask.size());
+    printf("index size:%.2lfMB -> %.2lfMB, reduced %.2lf%%\n", sizeBefore, sizeAfter, 100 * (sizeBefore - sizeAfter) / sizeBefore);
+    queryContext.profileQueries = queryContext.fallbackQueries = 0;
+}
+
+bool Graph::inProfile(uint mask) const
+{
+    return mask < profileMask.size() && profileMask[mask];
+}
+
+void Graph::reportProfile()
+{
+    auto &context = queryContext;
+    LL sum = context.profileQueries + context.fallbackQueries;
+    printf("queries in profile:%lld, fallback queries:%lld, fallback rate:%.2lf%%\n", context.profileQueries, context.fallbackQueries, sum ? 100.0 * context.fallbackQueries / sum : 0.0);
 }
 
 void Graph::clear()
@@ -2,7 +2,12 @@
 
 vector<PDI> Graph::dijkstra(int s, LabelSet labels)
 {
-    vector<double> dist(n + 1, INT_MAX);
+    return dijkstra(s, labels, queryK);
+}
+
+vector<PDI> Graph::dijkstra(int s, LabelSet labels, int k) const
+{
+    vector<Dist> dist(n + 1, inf);
     dist[s] = 0;
     vector<bool> st(n + 1, false);
     priority_queue<PDI, vector<PDI>, greater<PDI>> heap;
@@ -25,9 +30,9 @@ vector<PDI> Graph::dijkstra(int s, LabelSet labels)
         if (result.size() == k)
             break;
         for (auto &edge : edges[v])
-            if (labels.includes(edge.label) && d + edge.weight < dist[edge.target])
+            if (labels.includes(edge.label) && addDist(d, edge.weight) < dist[edge.target])
             {
-                dist[edge.target] = d + edge.weight;
+                dist[edge.target] = addDist(d, edge.weight);
                 heap.push({dist[edge.target], edge.target});
             }
     }
@@ -36,113 +41,280 @@ vector<PDI> Graph::dijkstra(int s, LabelSet labels)
 
 vector<PDI> Graph::query(int u, LabelSet labels)
 {
+    return query(u, labels, queryK);
+}
+
+vector<PDI> Graph::query(int u, LabelSet labels, int k)
+{
+    // the tiered and lazy modes bring the index of u into memory, the rest of a query only reads
+    if (tiered && (hasIndex.empty() || hasIndex[u]))
+        fetch(u);
+    if (lazy)
+        materialize(u);
+    return query(queryContext, u, labels, k);
+}
+
+vector<PDI> Graph::query(QueryContext &context, int u, LabelSet labels, int k) const
+{
+    if (!resultCache.enabled() || (!region.empty() && !region[u]))
+        return queryIndex(context, u, labels, k);
+    context.miss = context.fallback = false;
+    vector<PDI> result;
+    if (resultCache.find(u, labels.getLabels(), indexVersion[u], k, result))
+        return result;
+    result = queryIndex(context, u, labels, k);
+    if (!context.fallback)
+        resultCache.insert(u, labels.getLabels(), context.support, indexVersion[u], k, result);
+    return result;
+}
+
+// the lists of an index for k also answer any smaller k exactly:
+// each list is consumed only up to the k-th returned neighbor
+vector<PDI> Graph::queryIndex(QueryContext &context, int u, LabelSet labels, int k) const
+{
+    // results not selected from index entries are reused only for the same mask
+    context.support = labels.getLabels();
+    context.miss = context.fallback = false;
+    if (!region.empty() && !region[u])
+    {
+        // no index is loaded outside the region, the caller checks context.miss
+        context.regionMisses++;
+        context.miss = true;
+        return {};
+    }
+    if (!profileMask.empty())
+    {
+        // the pruned index misses entries of masks outside the profile
+        if (!inProfile(labels.getLabels()))
+        {
+            context.fallbackQueries++;
+            context.fallback = true;
+            return dijkstra(u, labels, min(k, this->k));
+        }
+        context.profileQueries++;
+    }
+    if (!hasIndex.empty() && !hasIndex[u])
+    {
+        context.fallbackQueries++;
+        context.fallback = true;
+        return dijkstra(u, labels, min(k, this->k));
+    }
+    if (frozen)
+        return queryFrozen(u, labels, k);
+    if (compressed)
+        return queryCompressed(u, labels, k);
+    if (!derived.empty() && derived[u])
+    {
+        IndexList indexList = deriveIndex(u);
+        return indexList.select(u, checkPOI(u), labels, n, min(k, this->k), nullptr, &context.support);
+    }
+    if (shared)
+        return queryShared(u, labels, k, context.support);
+    auto &indexList = trees[u].list;
+    if (!labelLookup.empty())
+    {
+        context.entries.resize(max(context.entries.size(), indexList.list.size()));
+        int count = labelLookup.lookup(u, labels.getLabels(), lookupStrategy, context.entries.data());
+        return indexList.select(u, checkPOI(u), context.entries.data(), count, n, min(k, this->k), nullptr, &context.support);
+    }
+    return indexList.select(u, checkPOI(u), labels, n, min(k, this->k), nullptr, &context.support);
+}
+
+vector<PDI> Graph::query(IndexList &indexList, int u, LabelSet &labels)
+{
+    return query(indexList, u, labels, queryK);
+}
+
+vector<PDI> Graph::query(IndexList &indexList, int u, LabelSet &labels, int k)
+{
+    return query(indexList, checkPOI(u), u, labels, k);
+}
+
+vector<PDI> Graph::query(IndexList &indexList, bool poi, int u, LabelSet &labels, int k) const
+{
+    return indexList.select(u, poi, labels, n, min(k, this->k));
+}
+
+// the same selection as the list query, scanning a cursor per entry of the CSR arrays
+// the same heap merge as IndexList::select, over the knn ranges of the included entries
+vector<PDI> Graph::queryFrozen(int u, LabelSet labels, int k) const
+{
+    k = min(k, this->k);
     vector<PDI> result;
     result.reserve(k);
-    set<uint> st;
-    int num = k;
+    auto &visited = VisitMark::local(n);
     if (checkPOI(u))
     {
         result.emplace_back(0, u);
-        st.insert(u);
-        num--;
+        visited.set(u);
     }
 
-    vector<pair<LabelSet, KNNList>> querySet;
-    for (auto [s, knn] : trees[u].list.list)
-        if (labels.includes(s))
-            querySet.emplace_back(s, knn);
-    vector<bool> isRemoved(querySet.size());
-    for (int i = 1; i <= num; i++)
+    auto &index = frozenIndex;
+    ScratchArena::Scope scope;
+    // (head distance, entry, position) of each included entry, a min-heap
+    pmr::vector<tuple<Dist, uint, uint64_t>> heap(&scope.arena);
+    heap.reserve(index.entryOffset[u + 1] - index.entryOffset[u]);
+    for (uint e = index.entryOffset[u]; e < index.entryOffset[u + 1]; e++)
+        if (labels.includes(LabelSet(index.labels[e])) && index.knnOffset[e] < index.knnOffset[e + 1])
+            heap.emplace_back(index.dist[index.knnOffset[e]], e, index.knnOffset[e]);
+    auto after = [](const tuple<Dist, uint, uint64_t> &a, const tuple<Dist, uint, uint64_t> &b)
+    { return a > b; };
+    make_heap(heap.begin(), heap.end(), after);
+
+    while (result.size() < k && !heap.empty())
     {
-        int v = 0;
-        double dist = inf;
-        for (int j = 0; j < querySet.size(); j++)
+        pop_heap(heap.begin(), heap.end(), after);
+        auto &[d, e, p] = heap.back();
+        int w = index.vertex[p];
+        if (!visited.test(w))
         {
-            auto &[s, knn] = querySet[j];
-            bool flag = true;
-            for (int p = 0; p < knn.size(); p++)
-            {
-                auto &[d, w] = knn.list[p];
-                if (st.count(w) == 0)
-                {
-                    if (d < dist)
-                    {
-                        v = w;
-                        dist = d;
-                    }
-                    knn.list.erase(knn.list.begin(), knn.list.begin() + p);
-                    flag = false;
-                    break;
-                }
-            }
-            isRemoved[j] = flag;
+            result.emplace_back(d, w);
+            visited.set(w);
         }
-        for (int j = querySet.size() - 1; j >= 0; j--)
-            if (isRemoved[j])
-                querySet.erase(querySet.begin() + j);
-        if (v)
+        if (++p < index.knnOffset[e + 1])
         {
-            result.emplace_back(dist, v);
-            st.insert(v);
+            d = index.dist[p];
+            push_heap(heap.begin(), heap.end(), after);
         }
         else
-            break;
+            heap.pop_back();
     }
     return result;
 }
 
-vector<PDI> Graph::query(IndexList &indexList, int u, LabelSet &labels)
+// the same heap merge as IndexList::select, over cursors into the payloads of the pool
+vector<PDI> Graph::queryShared(int u, LabelSet labels, int k, uint &support) const
 {
+    k = min(k, this->k);
+    support = 0;
     vector<PDI> result;
     result.reserve(k);
-    set<uint> st;
-    int num = k;
+    auto &visited = VisitMark::local(n);
     if (checkPOI(u))
     {
         result.emplace_back(0, u);
-        st.insert(u);
-        num--;
+        visited.set(u);
     }
-    vector<pair<LabelSet, KNNList>> querySet;
-    for (auto [s, knn] : indexList.list)
-        if (labels.includes(s))
-            querySet.emplace_back(s, knn);
-    vector<bool> isRemoved(querySet.size());
-    for (int i = 1; i <= num; i++)
+
+    auto &entries = sharedList[u];
+    ScratchArena::Scope scope;
+    // (head distance, entry, position in the pool) of each included entry, a min-heap
+    pmr::vector<tuple<Dist, int, uint>> heap(&scope.arena);
+    heap.reserve(entries.size());
+    for (int e = 0; e < entries.size(); e++)
     {
-        int v = 0;
-        double dist = inf;
-        for (int j = 0; j < querySet.size(); j++)
+        auto &[s, base, p] = entries[e];
+        if (labels.includes(s) && knnPool.offset[p] < knnPool.offset[p + 1])
+            heap.emplace_back(base + knnPool.deltas[knnPool.offset[p]], e, knnPool.offset[p]);
+    }
+    auto after = [](const tuple<Dist, int, uint> &a, const tuple<Dist, int, uint> &b)
+    { return a > b; };
+    make_heap(heap.begin(), heap.end(), after);
+
+    while (result.size() < k && !heap.empty())
+    {
+        pop_heap(heap.begin(), heap.end(), after);
+        auto &[d, e, i] = heap.back();
+        auto &[s, base, p] = entries[e];
+        int w = knnPool.ids[i];
+        if (!visited.test(w))
         {
-            auto &[s, knn] = querySet[j];
-            bool flag = true;
-            for (int p = 0; p < knn.size(); p++)
-            {
-                auto &[d, w] = knn.list[p];
-                if (st.count(w) == 0)
-                {
-                    if (d < dist)
-                    {
-                        v = w;
-                        dist = d;
-                    }
-                    knn.list.erase(knn.list.begin(), knn.list.begin() + p);
-                    flag = false;
-                    break;
-                }
-            }
-            isRemoved[j] = flag;
+            result.emplace_back(d, w);
+            visited.set(w);
+            support |= s.getLabels();
         }
-        for (int j = querySet.size() - 1; j >= 0; j--)
-            if (isRemoved[j])
-                querySet.erase(querySet.begin() + j);
-        if (v)
+        if (++i < knnPool.offset[p + 1])
         {
-            result.emplace_back(dist, v);
-            st.insert(v);
+            d = base + knnPool.deltas[i];
+            push_heap(heap.begin(), heap.end(), after);
         }
         else
+            heap.pop_back();
+    }
+    return result;
+}
+
+// the same heap merge over cursors that decode each included entry only as far as the selection reads it
+vector<PDI> Graph::queryCompressed(int u, LabelSet labels, int k) const
+{
+    k = min(k, this->k);
+    vector<PDI> result;
+    result.reserve(k);
+    auto &visited = VisitMark::local(n);
+    if (checkPOI(u))
+    {
+        result.emplace_back(0, u);
+        visited.set(u);
+    }
+
+    auto &index = compressedIndex;
+    ScratchArena::Scope scope;
+    pmr::vector<CompressedIndex::Cursor> cursors(&scope.arena);
+    uint64_t item = index.itemOffset[u];
+    uint64_t byte = index.byteOffset[u];
+    for (uint e = index.entryOffset[u]; e < index.entryOffset[u + 1]; e++)
+    {
+        if (labels.includes(LabelSet(index.label(e))))
+        {
+            CompressedIndex::Cursor c{byte, item, item + index.counts[e], 0, 0, 0};
+            if (index.next(c))
+                cursors.emplace_back(c);
+        }
+        item += index.counts[e];
+        byte += index.sizes[e];
+    }
+    // (head distance, cursor) of each included entry, a min-heap
+    pmr::vector<pair<Dist, int>> heap(&scope.arena);
+    heap.reserve(cursors.size());
+    for (int i = 0; i < cursors.size(); i++)
+        heap.emplace_back(cursors[i].dist, i);
+    auto after = [](const pair<Dist, int> &a, const pair<Dist, int> &b)
+    { return a > b; };
+    make_heap(heap.begin(), heap.end(), after);
+
+    while (result.size() < k && !heap.empty())
+    {
+        pop_heap(heap.begin(), heap.end(), after);
+        auto &[d, i] = heap.back();
+        auto &c = cursors[i];
+        if (!visited.test(c.vertex))
+        {
+            result.emplace_back(d, c.vertex);
+            visited.set(c.vertex);
+        }
+        if (index.next(c))
+        {
+            d = c.dist;
+            push_heap(heap.begin(), heap.end(), after);
+        }
+        else
+            heap.pop_back();
+    }
+    return result;
+}
+
+// the k nearest POI of the union are among the k nearest POI of each category
+vector<PDI> Graph::query(vector<int> &category, int u, LabelSet labels, int k)
+{
+    k = min(k, this->k);
+    vector<PDI> candidates;
+    for (auto &c : category)
+    {
+        auto knn = query(categories[c].lists[u], categories[c].isPOI[u], u, labels, k);
+        candidates.insert(candidates.end(), knn.begin(), knn.end());
+    }
+    sort(candidates.begin(), candidates.end());
+
+    // a vertex may be a POI of several categories
+    vector<PDI> result;
+    result.reserve(k);
+    unordered_set<int> st;
+    for (auto &[d, v] : candidates)
+    {
+        if (result.size() == k)
             break;
+        if (st.insert(v).second)
+            result.emplace_back(d, v);
     }
     return result;
 }
@@ -171,6 +343,17 @@ string Graph::generateRandomLabel(int nums)
     return labels;
 }
 
+// p50 and p99 of the latency of a batch of queries in seconds
+static void reportLatency(string name, vector<double> &latency)
+{
+    if (latency.empty())
+        return;
+    sort(latency.begin(), latency.end());
+    auto percentile = [&](double p)
+    { return latency[min(latency.size() - 1, size_t(p * latency.size()))] * 1e6; };
+    printf("latency of %squeries p50:%.2lfus, p99:%.2lfus\n", name.c_str(), percentile(0.5), percentile(0.99));
+}
+
 void Graph::queryByGroup(string queryFolder)
 {
     double queryTotalTime = 0;
@@ -185,14 +368,19 @@ void Graph::queryByGroup(string queryFolder)
         cerr << fixed << setprecision(2);
         double queryTime = 0;
         double dijkstraTime = 0;
+        vector<double> latency;
         while (fin >> v >> labels)
         {
             auto queryStart = chrono::high_resolution_clock::now();
 
             auto knn1 = query(v, labels);
+            // a source outside the region has no answer to time or check
+            if (queryContext.miss)
+                continue;
             auto queryEnd = chrono::high_resolution_clock::now();
             chrono::duration<double> queryDuration = queryEnd - queryStart;
             queryTime += queryDuration.count();
+            latency.emplace_back(queryDuration.count());
 
             auto dijkstraStart = chrono::high_resolution_clock::now();
             auto knn2 = dijkstra(v, labels);
@@ -205,7 +393,7 @@ void Graph::queryByGroup(string queryFolder)
             {
                 auto &[d1, v1] = knn1[i];
                 auto &[d2, v2] = knn2[i];
-                if (abs(d1 - d2) > 1e-8)
+                if (abs(double(d1) - double(d2)) > 1e-8)
                 {
                     flag = true;
                     wrong++;
@@ -233,7 +421,9 @@ void Graph::queryByGroup(string queryFolder)
             }
         }
         printf("the total time token for the %d-th group of queries using index is %.2lfms\n", i, queryTime * 1000);
-        printf("the total time token for the %d-th group of queries using dijkstra algorithm is %.2lfms\n\n", i, dijkstraTime * 1000);
+        printf("the total time token for the %d-th group of queries using dijkstra algorithm is %.2lfms\n", i, dijkstraTime * 1000);
+        reportLatency("the " + to_string(i) + "-th group of ", latency);
+        printf("\n");
         fin.close();
         queryTotalTime += queryTime;
         dijkstraTotalTime += dijkstraTime;
@@ -242,6 +432,60 @@ void Graph::queryByGroup(string queryFolder)
     printf("the average time token for the queries using dijkstra algorithm is %.2lfms\n", dijkstraTotalTime * 100);
 }
 
+void Graph::buildLabelLookup()
+{
+    labelLookup.build(trees, n, labelSize);
+    int bitmaps = count_if(labelLookup.bitmap.begin(), labelLookup.bitmap.end(), [](int b)
+                           { return b >= 0; });
+    printf("label lookup:%.2lfMB, vertices with a submask bitmap:%d\n", labelLookup.bytes() / 1024.0 / 1024.0, bitmaps);
+}
+
+void Graph::queryLookup(string queryFolder)
+{
+    printf("begin lookup strategies...\n");
+    vector<pair<LabelLookup::Strategy, string>> strategies = {{LabelLookup::Scan, "scan"}, {LabelLookup::Enumerate, "enumerate"}, {LabelLookup::Adaptive, "adaptive"}};
+    for (int i = 1; i <= 10; i++)
+    {
+        string queryPath = queryFolder + "/query" + to_string(i) + ".txt";
+        ifstream fin(queryPath);
+        vector<pair<int, LabelSet>> queries;
+        int v;
+        string labels;
+        while (fin >> v >> labels)
+            queries.emplace_back(v, LabelSet(labels));
+        fin.close();
+        if (queries.empty())
+            continue;
+
+        int enumerated = 0;
+        for (auto &[v, labels] : queries)
+            enumerated += labelLookup.enumerates(v, labels.getLabels());
+
+        // each strategy runs the group three times and keeps its fastest run,
+        // the queries bypass the result cache, which would answer the later runs without a lookup
+        vector<double> times;
+        for (int s = 0; s < strategies.size(); s++)
+        {
+            lookupStrategy = strategies[s].first;
+            double best = inf;
+            for (int run = 0; run < 3; run++)
+            {
+                auto start = chrono::high_resolution_clock::now();
+                for (auto &[v, labels] : queries)
+                    queryIndex(queryContext, v, labels, queryK);
+                auto end = chrono::high_resolution_clock::now();
+                chrono::duration<double> duration = end - start;
+                best = min(best, duration.count());
+            }
+            times.emplace_back(best);
+        }
+        lookupStrategy = LabelLookup::Adaptive;
+
+        int winner = min_element(times.begin(), times.end() - 1) - times.begin();
+        printf("%d labels: scan %.3lfms, enumerate %.3lfms, adaptive %.3lfms (enumerated %.2lf%%), faster: %s\n", i, times[0] * 1000, times[1] * 1000, times[2] * 1000, 100.0 * enumerated / queries.size(), strategies[winner].second.c_str());
+    }
+}
+
 void Graph::query()
 {
     // the number of query vertices
@@ -262,6 +506,9 @@ void Graph::query()
         auto queryStart = chrono::high_resolution_clock::now();
 
         auto knn1 = query(v, labels);
+        // a source outside the region has no answer to time or check
+        if (queryContext.miss)
+            continue;
 
         auto queryEnd = chrono::high_resolution_clock::now();
         chrono::duration<double> queryDuration = queryEnd - queryStart;
@@ -278,7 +525,7 @@ void Graph::query()
         {
             auto &[d1, v1] = knn1[i];
             auto &[d2, v2] = knn2[i];
-            if (abs(d1 - d2) > 1e-8)
+            if (abs(double(d1) - double(d2)) > 1e-8)
             {
                 flag = true;
                 wrong++;
@@ -315,22 +562,47 @@ void Graph::query(string queryFolder)
     printf("begin query...\n");
     string queryPath = queryFolder + "/query.txt";
     ifstream fin(queryPath);
+    vector<pair<int, string>> queries;
     int v;
     string labels;
+    while (fin >> v >> labels)
+        queries.emplace_back(v, labels);
+    fin.close();
+
+    // in tiered mode the sources of the next batch are read ahead in file order
+    const int batch = 64;
     int wrong = 0;
     cerr << fixed << setprecision(2);
     double queryTime = 0;
     double dijkstraTime = 0;
-    while (fin >> v >> labels)
+    vector<double> latency;
+    latency.reserve(queries.size());
+    for (int i = 0; i < queries.size(); i++)
     {
+        auto &[v, labels] = queries[i];
+        if (tiered && i % batch == 0)
+        {
+            vector<int> sources;
+            for (int j = i; j < min(i + batch, int(queries.size())); j++)
+                sources.emplace_back(queries[j].first);
+            auto prefetchStart = chrono::high_resolution_clock::now();
+            prefetch(sources);
+            auto prefetchEnd = chrono::high_resolution_clock::now();
+            chrono::duration<double> prefetchDuration = prefetchEnd - prefetchStart;
+            queryTime += prefetchDuration.count();
+        }
         auto queryStart = chrono::high_resolution_clock::now();
 
         auto knn1 = query(v, labels);
         // auto knn1 = queryByLSDIndex(v, labels);
+        // a source outside the region has no answer to time or check
+        if (queryContext.miss)
+            continue;
 
         auto queryEnd = chrono::high_resolution_clock::now();
         chrono::duration<double> queryDuration = queryEnd - queryStart;
         queryTime += queryDuration.count();
+        latency.emplace_back(queryDuration.count());
 
         auto dijkstraStart = chrono::high_resolution_clock::now();
         auto knn2 = dijkstra(v, labels);
@@ -343,7 +615,7 @@ void Graph::query(string queryFolder)
         {
             auto &[d1, v1] = knn1[i];
             auto &[d2, v2] = knn2[i];
-            if (abs(d1 - d2) > 1)
+            if (abs(double(d1) - double(d2)) > 1)
             {
                 flag = true;
                 wrong++;
@@ -370,7 +642,192 @@ void Graph::query(string queryFolder)
             cerr << "\n\n";
         }
     }
+    printf("the total time token for the queries using index is %.6lfms\n", queryTime * 1000);
+    printf("the total time token for the queries using dijkstra algorithm is %.6lfms\n", dijkstraTime * 1000);
+    reportLatency("", latency);
+}
+
+void Graph::queryParallel(string queryFolder, int threads)
+{
+    if (lazy || tiered)
+    {
+        printf("the lazy and tiered modes change the index while querying, skip the parallel queries\n");
+        return;
+    }
+    printf("begin parallel query with %d threads...\n", threads);
+    string queryPath = queryFolder + "/query.txt";
+    ifstream fin(queryPath);
+    vector<pair<int, LabelSet>> queries;
+    int v;
+    string labels;
+    while (fin >> v >> labels)
+        queries.emplace_back(v, LabelSet(labels));
+    fin.close();
+    if (queries.empty())
+        return;
+
+    // repeat the query file up to about 100,000 queries, so the timing is not dominated by starting the threads
+    int rounds = max(1, 100000 / int(queries.size()));
+    int total = rounds * queries.size();
+    vector<QueryContext> contexts(threads);
+    vector<vector<double>> latency(threads);
+    auto start = chrono::high_resolution_clock::now();
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 64)
+    for (int i = 0; i < total; i++)
+    {
+        int t = omp_get_thread_num();
+        auto &[v, labels] = queries[i % queries.size()];
+        auto queryStart = chrono::high_resolution_clock::now();
+        query(contexts[t], v, labels, queryK);
+        auto queryEnd = chrono::high_resolution_clock::now();
+        chrono::duration<double> queryDuration = queryEnd - queryStart;
+        latency[t].emplace_back(queryDuration.count());
+    }
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> duration = end - start;
+
+    printf("%d queries in %.3lfs, throughput:%.0lf queries/s\n", total, duration.count(), total / duration.count());
+    for (int t = 0; t < threads; t++)
+    {
+        auto &times = latency[t];
+        if (times.empty())
+            continue;
+        double sum = accumulate(times.begin(), times.end(), 0.0);
+        sort(times.begin(), times.end());
+        printf("thread %d: %ld queries, mean:%.2lfus, p50:%.2lfus, p99:%.2lfus\n", t + 1, times.size(), sum / times.size() * 1e6, times[times.size() / 2] * 1e6, times[min(times.size() - 1, size_t(0.99 * times.size()))] * 1e6);
+        queryContext.merge(contexts[t]);
+    }
+}
+
+void Graph::enableResultCache(size_t capacity, int shards)
+{
+    resultCache.init(capacity, shards);
+    indexVersion.assign(n + 1, 0);
+    printf("result cache:%ld entries in %d shards\n", capacity, shards);
+}
+
+void Graph::bumpVersion(int v)
+{
+    if (!indexVersion.empty())
+        indexVersion[v]++;
+}
+
+void Graph::reportResultCache()
+{
+    LL hits = 0, supersetHits = 0, misses = 0, invalidations = 0, evictions = 0, entries = 0;
+    for (auto &shard : resultCache.shards)
+    {
+        hits += shard->hits;
+        supersetHits += shard->supersetHits;
+        misses += shard->misses;
+        invalidations += shard->invalidations;
+        evictions += shard->evictions;
+        entries += shard->order.size();
+    }
+    LL sum = hits + supersetHits + misses;
+    printf("result cache hits:%lld, superset hits:%lld, misses:%lld, hit rate:%.2lf%%\n", hits, supersetHits, misses, sum ? 100.0 * (hits + supersetHits) / sum : 0.0);
+    printf("result cache invalidations:%lld, evictions:%lld, cached results:%lld\n", invalidations, evictions, entries);
+}
+
+void Graph::queryCategory(string queryFolder)
+{
+    printf("begin query over %ld categories...\n", categories.size());
+    vector<int> category(categories.size());
+    iota(category.begin(), category.end(), 0);
+
+    // dijkstra checks the result against the union of the POI
+    vector<bool> poi(n + 1, false);
+    for (auto &c : categories)
+        for (int v = 1; v <= n; v++)
+            if (c.isPOI[v])
+                poi[v] = true;
+    isPOI.swap(poi);
+
+    string queryPath = queryFolder + "/query.txt";
+    ifstream fin(queryPath);
+    int v;
+    string labels;
+    int wrong = 0;
+    double queryTime = 0;
+    double dijkstraTime = 0;
+    while (fin >> v >> labels)
+    {
+        auto queryStart = chrono::high_resolution_clock::now();
+        auto knn1 = query(category, v, labels, queryK);
+        auto queryEnd = chrono::high_resolution_clock::now();
+        chrono::duration<double> queryDuration = queryEnd - queryStart;
+        queryTime += queryDuration.count();
+
+        auto dijkstraStart = chrono::high_resolution_clock::now();
+        auto knn2 = dijkstra(v, labels);
+        auto dijkstraEnd = chrono::high_resolution_clock::now();
+        chrono::duration<double> dijkstraDuration = dijkstraEnd - dijkstraStart;
+        dijkstraTime += dijkstraDuration.count();
+
+        bool flag = knn1.size() != knn2.size();
+        for (int i = 0; !flag && i < knn1.size(); i++)
+            if (abs(double(knn1[i].first) - double(knn2[i].first)) > 1e-8)
+                flag = true;
+        if (flag)
+        {
+            wrong++;
+            cerr << "wrong:" << wrong << "\n";
+            cerr << "v:" << v << "\n";
+            cerr << "label: " << labels.c_str() << "\n\n";
+        }
+    }
     fin.close();
+    isPOI.swap(poi);
     printf("the total time token for the queries using index is %.6lfms\n", queryTime * 1000);
     printf("the total time token for the queries using dijkstra algorithm is %.6lfms\n", dijkstraTime * 1000);
-}
\ No newline at end of file
+}
+
+tuple<double, double, double> Graph::queryApproximate(string queryFolder)
+{
+    printf("begin query with epsilon=%.3lf...\n", epsilon);
+    string queryPath = queryFolder + "/query.txt";
+    ifstream fin(queryPath);
+    int v;
+    string labels;
+    int wrong = 0;
+    int sum = 0;
+    double queryTime = 0;
+    double errorSum = 0;
+    double errorMax = 0;
+    while (fin >> v >> labels)
+    {
+        auto queryStart = chrono::high_resolution_clock::now();
+        auto knn1 = query(v, labels);
+        auto queryEnd = chrono::high_resolution_clock::now();
+        chrono::duration<double> queryDuration = queryEnd - queryStart;
+        queryTime += queryDuration.count();
+
+        auto knn2 = dijkstra(v, labels);
+
+        // the relative error of the i-th distance, a missing neighbor counts as a violation
+        double error = 0;
+        bool flag = knn1.size() != knn2.size();
+        for (int i = 0; !flag && i < knn1.size(); i++)
+        {
+            double d1 = knn1[i].first, d2 = knn2[i].first;
+            if (d2 > 0)
+                error = max(error, d1 / d2 - 1);
+            else if (d1 > 0)
+                flag = true;
+        }
+        if (flag || error > epsilon + 1e-9)
+        {
+            wrong++;
+            cerr << "wrong:" << wrong << "\n";
+            cerr << "v:" << v << "\n";
+            cerr << "label: " << labels.c_str() << "\n\n";
+        }
+        errorSum += error;
+        errorMax = max(errorMax, error);
+        sum++;
+    }
+    fin.close();
+    printf("mean error:%.4lf%%, max error:%.4lf%%, violations:%d\n", sum ? 100 * errorSum / sum : 0.0, 100 * errorMax, wrong);
+    printf("the total time token for the queries using index is %.6lfms\n", queryTime * 1000);
+    return make_tuple(queryTime * 1000, sum ? errorSum / sum : 0.0, errorMax);
+}
@@ -1,6 +1,13 @@
 #include "../include/Graph.h"
 
 void Graph::insertPOI(int insertedVertex)
+{
+    labelLookup.clear();
+    IndexView index(isPOI, trees);
+    insertPOI(index, insertedVertex);
+}
+
+void Graph::insertPOI(IndexView &index, int insertedVertex)
 {
     // record whether the index of each vertex has changed
     vector<bool> indexChanged(n + 1, false);
@@ -20,7 +27,7 @@ void Graph::insertPOI(int insertedVertex)
         {
             paths[u].combine(paths[v] + shortcuts[v][u]);
             // check
-            if (!indexChanged[u] && checkInsertion(u, paths[u]))
+            if (!indexChanged[u] && checkInsertion(index, u, paths[u]))
                 indexChanged[u] = true;
         }
     }
@@ -57,7 +64,7 @@ void Graph::insertPOI(int insertedVertex)
                 paths[v].combine(paths[u] + shortcuts[v][u]);
 
         // check
-        if (!indexChanged[v] && checkInsertion(v, paths[v]))
+        if (!indexChanged[v] && checkInsertion(index, v, paths[v]))
             indexChanged[v] = true;
 
         // insert descendants to queue
@@ -75,20 +82,24 @@ void Graph::insertPOI(int insertedVertex)
     for (int v = 1; v <= n; v++)
         if (indexChanged[v])
         {
+            // the result cache only holds results of the index in the tree nodes
+            if (index.trees)
+                bumpVersion(v);
             if (v == insertedVertex)
-                updateInsertion(v);
+                updateInsertion(index, v);
             else
             {
-                removeInsertion(v, paths[v]);
-                updateInsertion(insertedVertex, v, paths[v]);
+                removeInsertion(index, v, paths[v]);
+                updateInsertion(index, insertedVertex, v, paths[v]);
             }
         }
     // insert poi
-    isPOI[insertedVertex] = true;
+    index.isPOI[insertedVertex] = true;
 }
 
 vector<SCAttr> Graph::singleInsert(int insertedVertex)
 {
+    IndexView index(isPOI, trees);
     // record whether the index of each vertex has changed
     vector<bool> indexChanged(n + 1, false);
     indexChanged[insertedVertex] = true;
@@ -107,7 +118,7 @@ vector<SCAttr> Graph::singleInsert(int insertedVertex)
         {
             paths[u].combine(paths[v] + shortcuts[v][u]);
             // check
-            if (!indexChanged[u] && checkInsertion(u, paths[u]))
+            if (!indexChanged[u] && checkInsertion(index, u, paths[u]))
                 indexChanged[u] = true;
         }
     }
@@ -144,7 +155,7 @@ vector<SCAttr> Graph::singleInsert(int insertedVertex)
                 paths[v].combine(paths[u] + shortcuts[v][u]);
 
         // check
-        if (!indexChanged[v] && checkInsertion(v, paths[v]))
+        if (!indexChanged[v] && checkInsertion(index, v, paths[v]))
             indexChanged[v] = true;
 
         // insert descendants to queue
@@ -176,6 +187,7 @@ vector<SCAttr> Graph::singleInsert(int insertedVertex)
 
 void Graph::batchInsert(set<int> &poi)
 {
+    labelLookup.clear();
     vector<IndexList> receivedList(n + 1);
 
     for (auto &p : poi)
@@ -212,14 +224,17 @@ void Graph::batchInsert(set<int> &poi)
     for (int v = 1; v <= n; v++)
         if (!receivedList[v].list.empty())
         {
+            bumpVersion(v);
             trees[v].list.combine(v, receivedList[v], n, k);
             int poiV = checkPOI(v);
             trees[v].list.compensate(v, poiV, n, k);
         }
 
+    IndexView index(isPOI, trees);
     for (auto v : poi)
     {
-        updateInsertion(v);
+        bumpVersion(v);
+        updateInsertion(index, v);
         isPOI[v] = true;
     }
 }
@@ -236,73 +251,21 @@ vector<int> Graph::getAncestor(int u)
     return ancestors;
 }
 
-tuple<int, double, LabelSet> Graph::getLastNeighbor(int u, LabelSet labels)
+tuple<int, Dist, LabelSet> Graph::getLastNeighbor(IndexView &index, int u, LabelSet labels)
 {
     LabelSet originalLabels;
-
-    vector<PDI> result;
-    result.reserve(k);
-    set<uint> st;
-    int num = k;
-    if (checkPOI(u))
-    {
-        result.emplace_back(0, u);
-        st.insert(u);
-        num--;
-    }
-    vector<pair<LabelSet, KNNList>> querySet;
-    for (auto [s, knn] : trees[u].list.list)
-        if (labels.includes(s))
-            querySet.emplace_back(s, knn);
-    vector<bool> isRemoved(querySet.size());
-    while (num--)
-    {
-        int v = 0;
-        double dist = inf;
-        for (int j = 0; j < querySet.size(); j++)
-        {
-            auto &[s, knn] = querySet[j];
-            bool flag = true;
-            for (int p = 0; p < knn.size(); p++)
-            {
-                auto &[d, w] = knn.list[p];
-                if (st.count(w) == 0)
-                {
-                    if (d < dist)
-                    {
-                        v = w;
-                        dist = d;
-                        originalLabels = s;
-                    }
-                    knn.list.erase(knn.list.begin(), knn.list.begin() + p);
-                    flag = false;
-                    break;
-                }
-            }
-            isRemoved[j] = flag;
-        }
-        for (int j = querySet.size() - 1; j >= 0; j--)
-            if (isRemoved[j])
-                querySet.erase(querySet.begin() + j);
-        if (v)
-        {
-            result.emplace_back(dist, v);
-            st.insert(v);
-        }
-        else
-            break;
-    }
-    return make_tuple(k - num - 1, result.back().first, originalLabels);
+    auto result = index[u].select(u, index.checkPOI(u), labels, n, k, &originalLabels);
+    return make_tuple(int(result.size()), result.back().first, originalLabels);
 }
 
 // NOTE improve: consider only the edges that will affect the index
-bool Graph::checkInsertion(int v, SCAttr &path)
+bool Graph::checkInsertion(IndexView &index, int v, SCAttr &path)
 {
     int ptr = 0;
     auto &attrs = path.attrs;
     for (auto &[d1, s] : attrs)
     {
-        auto [id, d2, _] = getLastNeighbor(v, s);
+        auto [id, d2, _] = getLastNeighbor(index, v, s);
         if (d1 < d2 || id < k)
         {
             // remove useless path
@@ -314,14 +277,14 @@ bool Graph::checkInsertion(int v, SCAttr &path)
     return false;
 }
 
-void Graph::removeInsertion(int &v, SCAttr &path)
+void Graph::removeInsertion(IndexView &index, int &v, SCAttr &path)
 {
     auto &attrs = path.attrs;
     vector<bool> isRemoved(attrs.size(), false);
     for (int i = 0; i < attrs.size(); i++)
     {
         auto &[d1, s] = attrs[i];
-        auto [id, d2, _] = getLastNeighbor(v, s);
+        auto [id, d2, _] = getLastNeighbor(index, v, s);
         if (d1 >= d2 && id == k)
             isRemoved[i] = true;
     }
@@ -338,16 +301,16 @@ void Graph::removeInsertion(int &v, SCAttr &path)
 
 // NOTE  the index size may be smaller that k
 // label may decrease but not increase
-void Graph::updateInsertion(int &v)
+void Graph::updateInsertion(IndexView &index, int &v)
 {
-    auto &list = trees[v].list.list;
+    auto &list = index[v].list;
 
     // compute last nearest neighbor
     vector<int> ids(list.size());
     vector<LabelSet> indexLabels(list.size());
     for (int i = 0; i < list.size(); i++)
     {
-        auto [lastId, _, lastLabels] = getLastNeighbor(v, list[i].first);
+        auto [lastId, _, lastLabels] = getLastNeighbor(index, v, list[i].first);
         ids[i] = lastId;
         indexLabels[i] = lastLabels;
     }
@@ -389,11 +352,11 @@ void Graph::updateInsertion(int &v)
 }
 
 // NOTE improve: improve performance by modifying the order of paths
-void Graph::updateInsertion(int insertedVertex, int &v, SCAttr &path)
+void Graph::updateInsertion(IndexView &index, int insertedVertex, int &v, SCAttr &path)
 {
     auto attrs = path.attrs;
-    auto &list = trees[v].list.list;
-    sort(attrs.begin(), attrs.end(), [](const pair<double, LabelSet> &p1, const pair<double, LabelSet> &p2)
+    auto &list = index[v].list;
+    sort(attrs.begin(), attrs.end(), [](const pair<Dist, LabelSet> &p1, const pair<Dist, LabelSet> &p2)
          { return p1.second < p2.second; });
 
     vector<LabelSet> labels;
@@ -444,7 +407,7 @@ void Graph::updateInsertion(int insertedVertex, int &v, SCAttr &path)
     }
 
     // compute distance
-    vector<double> dist(labels.size(), inf);
+    vector<Dist> dist(labels.size(), inf);
     int ptr = 0;
     for (int i = 0; i < labels.size(); i++)
     {
@@ -465,14 +428,14 @@ void Graph::updateInsertion(int insertedVertex, int &v, SCAttr &path)
 
     // compute last nearest neighbor
     vector<int> ids(labels.size());
-    vector<double> indexDist(labels.size());
+    vector<Dist> indexDist(labels.size());
     vector<LabelSet> indexLabels(labels.size());
 
     for (int i = 0; i < labels.size(); i++)
     {
         if (dist[i] == inf)
             continue;
-        auto [lastId, lastDist, lastLabels] = getLastNeighbor(v, labels[i]);
+        auto [lastId, lastDist, lastLabels] = getLastNeighbor(index, v, labels[i]);
         ids[i] = lastId;
         indexDist[i] = lastDist;
         indexLabels[i] = lastLabels;
@@ -485,11 +448,11 @@ void Graph::updateInsertion(int insertedVertex, int &v, SCAttr &path)
         if (dist[i] == inf)
             continue;
         int &lastId = ids[i];
-        double &lastDist = indexDist[i];
+        Dist &lastDist = indexDist[i];
         LabelSet &lastLabels = indexLabels[i];
 
         LabelSet &pathLabels = labels[i];
-        double &pathDist = dist[i];
+        Dist &pathDist = dist[i];
         if (status[i] == 0)
         {
             // KNN is affected, but the inserted vertex already exists in the index of the subset
@@ -510,7 +473,7 @@ void Graph::updateInsertion(int insertedVertex, int &v, SCAttr &path)
             // add
             if (lastId < k)
             {
-                auto it = upper_bound(knn.begin(), knn.end(), pathDist, [](const double &d, const PDI &p)
+                auto it = upper_bound(knn.begin(), knn.end(), pathDist, [](const Dist &d, const PDI &p)
                                       { return d < p.first; });
                 knn.insert(it, make_pair(pathDist, insertedVertex));
             }
@@ -518,7 +481,7 @@ void Graph::updateInsertion(int insertedVertex, int &v, SCAttr &path)
             else if (lastId == k && pathDist < lastDist)
             {
                 // add
-                auto it = upper_bound(knn.begin(), knn.end(), pathDist, [](const double &d, const PDI &p)
+                auto it = upper_bound(knn.begin(), knn.end(), pathDist, [](const Dist &d, const PDI &p)
                                       { return d < p.first; });
                 knn.insert(it, make_pair(pathDist, insertedVertex));
                 // printf("site:%d\n", it - knn.begin());
@@ -545,7 +508,14 @@ void Graph::updateInsertion(int insertedVertex, int &v, SCAttr &path)
 
 void Graph::deletePOI(int deletedVertex)
 {
-    isPOI[deletedVertex] = false;
+    labelLookup.clear();
+    IndexView index(isPOI, trees);
+    deletePOI(index, deletedVertex);
+}
+
+void Graph::deletePOI(IndexView &index, int deletedVertex)
+{
+    index.isPOI[deletedVertex] = false;
     vector<int> ancestors = getAncestor(deletedVertex);
 
     // record the id of those vertices whose index require updating
@@ -557,7 +527,7 @@ void Graph::deletePOI(int deletedVertex)
     for (int i = 1; i < ancestors.size(); i++)
     {
         int v = ancestors[i];
-        if (trees[v].list.hasVertex(deletedVertex))
+        if (index[v].hasVertex(deletedVertex))
             deleteStatus[v] = true;
         else
             deleteStatus[v] = false;
@@ -578,7 +548,7 @@ void Graph::deletePOI(int deletedVertex)
         int id = que.top();
         que.pop();
         int v = orderMap[id];
-        if (!deleteStatus[v] && trees[v].list.hasVertex(deletedVertex))
+        if (!deleteStatus[v] && index[v].hasVertex(deletedVertex))
         {
             deleteStatus[v] = true;
             idSet.insert(orderId[v]);
@@ -596,14 +566,16 @@ void Graph::deletePOI(int deletedVertex)
     for (auto it = idSet.rbegin(); it != idSet.rend(); ++it)
     {
         int &v = orderMap[*it];
+        if (index.trees)
+            bumpVersion(v);
 
         for (auto &u : descendants[v])
         {
-            int poiU = checkPOI(u);
-            trees[v].list.combine(v, IndexList::join(v, shortcuts[v][u], trees[u].list, poiU, n, k), n, k);
+            int poiU = index.checkPOI(u);
+            index[v].combine(v, IndexList::join(v, shortcuts[v][u], index[u], poiU, n, k), n, k);
         }
-        int poiV = checkPOI(v);
-        trees[v].list.compensate(v, poiV, n, k);
+        int poiV = index.checkPOI(v);
+        index[v].compensate(v, poiV, n, k);
     }
 
     // update index from top to down
@@ -613,11 +585,11 @@ void Graph::deletePOI(int deletedVertex)
 
         for (auto &u : trees[v].neighbors)
         {
-            int poiU = checkPOI(u);
-            trees[v].list.combine(v, IndexList::join(v, shortcuts[v][u], trees[u].list, poiU, n, k), n, k);
+            int poiU = index.checkPOI(u);
+            index[v].combine(v, IndexList::join(v, shortcuts[v][u], index[u], poiU, n, k), n, k);
         }
-        int poiV = checkPOI(v);
-        trees[v].list.compensate(v, poiV, n, k);
+        int poiV = index.checkPOI(v);
+        index[v].compensate(v, poiV, n, k);
     }
 }
 
@@ -670,6 +642,7 @@ unordered_map<int, bool> Graph::singleDelete(int deletedVertex)
 
 void Graph::batchDelete(set<int> &poi)
 {
+    labelLookup.clear();
     set<int, greater<int>> idSet;
     vector<bool> deleteStatus(n + 1, false);
 
@@ -689,6 +662,7 @@ void Graph::batchDelete(set<int> &poi)
     for (auto it = idSet.rbegin(); it != idSet.rend(); ++it)
     {
         int &v = orderMap[*it];
+        bumpVersion(v);
         for (auto &u : descendants[v])
         {
             int poiU = checkPOI(u);
@@ -714,6 +688,82 @@ void Graph::batchDelete(set<int> &poi)
     printf("affected vertex:%ld\n", idSet.size());
 }
 
+// the lists of the category are updated in place, as constructIndex builds them
+void Graph::insertPOI(int c, int insertedVertex)
+{
+    auto &category = categories[c];
+    category.lists.resize(n + 1);
+    IndexView index(category.isPOI, category.lists);
+    insertPOI(index, insertedVertex);
+}
+
+void Graph::deletePOI(int c, int deletedVertex)
+{
+    auto &category = categories[c];
+    category.lists.resize(n + 1);
+    IndexView index(category.isPOI, category.lists);
+    deletePOI(index, deletedVertex);
+}
+
+bool Graph::compactIndex(double seconds)
+{
+    labelLookup.clear();
+    auto start = high_resolution_clock::now();
+    while (compactCursor <= n)
+    {
+        // check the clock every 64 vertices, compensating a vertex takes microseconds
+        for (int i = 0; i < 64 && compactCursor <= n; i++, compactCursor++)
+        {
+            int v = compactCursor;
+            if (!hasIndex.empty() && !hasIndex[v])
+                continue;
+            auto &list = trees[v].list;
+            size_t before = list.bytes();
+            list.compensate(v, checkPOI(v), n, k);
+            list.list.shrink_to_fit();
+            for (auto &[s, knn] : list.list)
+                knn.list.shrink_to_fit();
+            compactReclaimed += LL(before) - LL(list.bytes());
+        }
+        duration<double> elapsed = high_resolution_clock::now() - start;
+        if (elapsed.count() >= seconds)
+            break;
+    }
+    if (compactCursor <= n)
+        return false;
+    compactCursor = 1;
+    return true;
+}
+
+void Graph::compactIndex()
+{
+    printf("begin compact index...\n");
+    const double slice = 0.01;
+    LL before = 0;
+    for (int v = 1; v <= n; v++)
+        before += trees[v].list.bytes();
+
+    compactCursor = 1;
+    compactReclaimed = 0;
+    int slices = 1;
+    double longest = 0;
+    auto start = high_resolution_clock::now();
+    while (true)
+    {
+        auto sliceStart = high_resolution_clock::now();
+        bool done = compactIndex(slice);
+        duration<double> sliceDuration = high_resolution_clock::now() - sliceStart;
+        longest = max(longest, sliceDuration.count());
+        if (done)
+            break;
+        slices++;
+    }
+    duration<double> total = high_resolution_clock::now() - start;
+
+    printf("compaction time:%.2lfms in %d slices, longest slice:%.2lfms\n", total.count() * 1000, slices, longest * 1000);
+    printf("index memory:%.2lfMB -> %.2lfMB, reclaimed %.2lfMB\n", before / 1024.0 / 1024.0, (before - compactReclaimed) / 1024.0 / 1024.0, compactReclaimed / 1024.0 / 1024.0);
+}
+
 void Graph::insertPOI(string folder)
 {
     printf("begin insert poi...\n");
@@ -752,7 +802,7 @@ void Graph::deletePOI(string folder)
     printf("update time after deletion of POIs:%.2lfs\n", duration.count());
 }
 
-void Graph::updatePOI(string poiFolder)
+void Graph::updatePOI(string poiFolder, int category)
 {
     printf("begin update poi...\n");
     vector<pair<char, int>> updatedPOI;
@@ -760,7 +810,12 @@ void Graph::updatePOI(string poiFolder)
     int v;
     ifstream fin(poiFolder);
     while (fin >> c >> v)
+    {
+        // the file lists updates of the main POI set
+        if (category >= 0 && categories[category].isPOI[v] == (c == 'i'))
+            continue;
         updatedPOI.emplace_back(c, v);
+    }
     fin.close();
 
     int insertSum = 0;
@@ -771,7 +826,14 @@ void Graph::updatePOI(string poiFolder)
     for (auto &[c, v] : updatedPOI)
     {
         auto start = high_resolution_clock::now();
-        if (c == 'i')
+        if (category >= 0)
+        {
+            if (c == 'i')
+                insertPOI(category, v);
+            else if (c == 'd')
+                deletePOI(category, v);
+        }
+        else if (c == 'i')
             insertPOI(v);
         else if (c == 'd')
             deletePOI(v);
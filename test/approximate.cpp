@@ -0,0 +1,95 @@
+#include "../include/Graph.h"
+
+int main(int argc, char *argv[])
+{
+    string graphName = "COL";
+    int labelSize = 10;
+    int k = 20;
+    string poiDensity = "005";
+    set<string> densityList = {"001", "005", "010", "050", "100"};
+    string subgraphId = "0";
+    // the error bounds to sweep
+    string epsilonList = "0,0.01,0.05,0.1,0.2,0.5";
+
+    int option = -1;
+    while (-1 != (option = getopt(argc, argv, "n:k:d:l:s:e:")))
+    {
+        if (option == 'n')
+            graphName = optarg;
+        else if (option == 'k')
+            k = stoi(optarg);
+        else if (option == 'd')
+        {
+            if (!densityList.count(optarg))
+            {
+                printf("please specify the POI density -d in [\"001\", \"005\", \"010\", \"050\", \"100\"]\n");
+                return 0;
+            }
+            poiDensity = optarg;
+        }
+        else if (option == 'l')
+            labelSize = stoi(optarg);
+        else if (option == 's')
+            subgraphId = optarg;
+        else if (option == 'e')
+            epsilonList = optarg;
+    }
+    string folder = "datasets/" + graphName + "/";
+
+    string graphPath = folder + "USA-road." + graphName + ".gr";
+    if (subgraphId != "0")
+        graphPath = folder + "/subgraph/USA-road." + graphName + "." + subgraphId + ".gr";
+    string poiPath = folder + "/POI/POI" + poiDensity + ".txt";
+    string indexPath = folder + "/index/index.k" + to_string(k) + ".density" + poiDensity + ".txt";
+    if (subgraphId != "0")
+        indexPath = folder + "/index/index.k" + to_string(k) + ".density" + poiDensity + "." + subgraphId + ".txt";
+    string queryFolder = folder + "/query";
+    string indexFolder = folder + "/index";
+    if (!filesystem::exists(indexFolder))
+        filesystem::create_directory(indexFolder);
+
+    Graph graph(graphPath, labelSize, k);
+    printf("graph path: %s\n", graphPath.c_str());
+
+    graph.loadPOI(poiPath);
+
+    if (filesystem::exists(indexPath))
+        graph.loadIndex2(indexPath);
+    else
+    {
+        graph.buildIndex();
+        graph.storeIndex2(indexPath);
+    }
+
+    vector<IndexList> exact(graph.n + 1);
+    for (int v = 1; v <= graph.n; v++)
+        exact[v] = graph.trees[v].list;
+
+    // (epsilon, index size, label sets, query time, mean error, max error)
+    vector<tuple<double, double, LL, double, double, double>> table;
+    stringstream ss(epsilonList);
+    string value;
+    while (getline(ss, value, ','))
+    {
+        for (int v = 1; v <= graph.n; v++)
+            graph.trees[v].list = exact[v];
+        graph.approximateIndex(stod(value));
+
+        LL labelCount = 0;
+        LL indexCount = 0;
+        for (int v = 1; v <= graph.n; v++)
+        {
+            labelCount += graph.trees[v].list.list.size();
+            indexCount += graph.trees[v].list.entries();
+        }
+        double indexSize = (graph.n * 4 + labelCount * 4 + indexCount * 8) / 1024 / 1024.0;
+
+        auto [queryTime, errorMean, errorMax] = graph.queryApproximate(queryFolder);
+        table.emplace_back(graph.epsilon, indexSize, labelCount, queryTime, errorMean, errorMax);
+    }
+
+    printf("\n%-10s%-16s%-14s%-16s%-16s%-16s\n", "epsilon", "index size(MB)", "label sets", "query time(ms)", "mean error(%)", "max error(%)");
+    for (auto &[epsilon, indexSize, labelCount, queryTime, errorMean, errorMax] : table)
+        printf("%-10.3lf%-16.2lf%-14lld%-16.3lf%-16.4lf%-16.4lf\n", epsilon, indexSize, labelCount, queryTime, 100 * errorMean, 100 * errorMax);
+    return 0;
+}
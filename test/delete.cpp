@@ -5,17 +5,27 @@ int main(int argc, char *argv[])
     string graphName = "COL";
     int labelSize = 10;
     int k = 20;
+    // k of the index, which answers any k no larger than it
+    int indexK = 0;
     string poiDensity = "005";
     set<string> densityList = {"001", "005", "010", "050", "100"};
     string subgraphId = "0";
+    // compact the index after the updates
+    bool compacting = false;
+    // cache query results, queried once before the updates so they invalidate cached results
+    int cacheEntries = 0;
+    // query the frozen index before the updates, then thaw it and check that it stores the same file
+    bool freezing = false;
 
     int option = -1;
-    while (-1 != (option = getopt(argc, argv, "n:k:d:l:s:")))
+    while (-1 != (option = getopt(argc, argv, "n:k:m:d:l:s:CE:F")))
     {
         if (option == 'n')
             graphName = optarg;
         else if (option == 'k')
             k = stoi(optarg);
+        else if (option == 'm')
+            indexK = stoi(optarg);
         else if (option == 'd')
         {
             if (!densityList.count(optarg))
@@ -29,7 +39,14 @@ int main(int argc, char *argv[])
             labelSize = stoi(optarg);
         else if (option == 's')
             subgraphId = optarg;
+        else if (option == 'C')
+            compacting = true;
+        else if (option == 'E')
+            cacheEntries = stoi(optarg);
+        else if (option == 'F')
+            freezing = true;
     }
+    indexK = max(indexK, k);
     string folder = "datasets/" + graphName + "/";
 
     string graphPath = folder + "USA-road." + graphName + ".gr";
@@ -38,9 +55,9 @@ int main(int argc, char *argv[])
     string poiPath = folder + "/POI/POI" + poiDensity + ".txt";
     string orderPath = folder + "/order.txt";
     // string indexPath = folder + "/index/index" + indexFile + ".txt";
-    string indexPath = folder + "/index/index.k" + to_string(k) + ".density" + poiDensity + ".txt";
+    string indexPath = folder + "/index/index.k" + to_string(indexK) + ".density" + poiDensity + ".txt";
     if (subgraphId != "0")
-        indexPath = folder + "/index/index.k" + to_string(k) + ".density" + poiDensity + "." + subgraphId + ".txt";
+        indexPath = folder + "/index/index.k" + to_string(indexK) + ".density" + poiDensity + "." + subgraphId + ".txt";
     string queryFolder = folder + "/query";
     string indexFolder = folder + "/index";
     if (!filesystem::exists(indexFolder))
@@ -48,7 +65,8 @@ int main(int argc, char *argv[])
 
     string poiFolder = folder + "delete.txt";
 
-    Graph graph(graphPath, labelSize, k);
+    Graph graph(graphPath, labelSize, indexK);
+    graph.queryK = k;
     printf("graph path: %s\n", graphPath.c_str());
 
     graph.loadPOI(poiPath);
@@ -64,9 +82,33 @@ int main(int argc, char *argv[])
         graph.loadIndex2(indexPath);
     }
 
+    if (freezing)
+    {
+        graph.freeze();
+        graph.query(queryFolder);
+        graph.thaw();
+        string thawedPath = indexPath + ".thawed";
+        graph.storeIndex2(thawedPath);
+        ifstream stored(indexPath, ios::binary), thawed(thawedPath, ios::binary);
+        bool identical = equal(istreambuf_iterator<char>(stored), istreambuf_iterator<char>(),
+                               istreambuf_iterator<char>(thawed), istreambuf_iterator<char>());
+        printf("thawed index identical to the stored index:%s\n", identical ? "yes" : "no");
+        filesystem::remove(thawedPath);
+    }
+
+    if (cacheEntries > 0)
+    {
+        graph.enableResultCache(cacheEntries, 16);
+        graph.query(queryFolder);
+    }
+
     graph.updatePOI(poiFolder);
+    if (compacting)
+        graph.compactIndex();
 
     graph.query(queryFolder);
+    if (cacheEntries > 0)
+        graph.reportResultCache();
 
     return 0;
 }
\ No newline at end of file
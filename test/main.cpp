@@ -5,17 +5,62 @@ int main(int argc, char *argv[])
     string graphName = "COL";
     int labelSize = 10;
     int k = 20;
+    // k of the index, which answers any k no larger than it
+    int indexK = 0;
     string poiDensity = "005";
     set<string> densityList = {"001", "005", "010", "050", "100"};
     string subgraphId = "0";
+    // stream the index into its file while building it
+    bool streaming = false;
+    // write checkpoints while building, and resume from the last one
+    bool checkpoint = false;
+    bool resume = false;
+    double checkpointInterval = 600;
+    // complete the index on demand under a memory budget in MB, 0 for the full index
+    double lazyBudget = 0;
+    // POI densities indexed as categories on one decomposition, e.g. 001,010,050
+    string categoryList;
+    // apply the insertions and deletions of the dataset to the first category before its queries
+    bool categoryUpdate = false;
+    // the number of worker processes building disjoint subtrees, 0 to build in this process
+    int workers = 0;
+    // intern the knn payloads of the index before answering queries
+    bool sharing = false;
+    // derive the index of width 1 and 2 vertices when it stores at least ratio times the entries it reads, -1 to store all
+    double derivedRatio = -1;
+    // query file whose label masks the index is pruned to, other masks fall back to dijkstra
+    string profilePath;
+    // file of the source vertices of queries, for which alone the index is built
+    string sourcePath;
+    // answer queries from the frozen CSR layout
+    bool freezing = false;
+    // answer queries from the compressed encoding, stored next to the index file
+    bool compressing = false;
+    // query a frozen index file mapped into memory, writing it first if it does not exist
+    bool mapping = false;
+    // query the index file on disk with a memory budget in MB for the cached lists, 0 to load the whole index
+    double tierBudget = 0;
+    // pack the label masks of the index and compare the subset lookup strategies on the groups of queries
+    bool lookup = false;
+    // threads of the parallel batch of queries run after the serial one, 0 to skip it
+    int queryThreads = 0;
+    // entries of the query result cache, 0 to query the index directly
+    int cacheEntries = 0;
+    // load the index only in a region: the vertices of a file and those within radius hops of them,
+    // or the vertices in a coordinate box x1,y1,x2,y2 of the .co file
+    string regionPath;
+    int regionRadius = 0;
+    string regionBox;
 
     int option = -1;
-    while (-1 != (option = getopt(argc, argv, "n:k:d:l:s:")))
+    while (-1 != (option = getopt(argc, argv, "n:k:m:d:l:s:Sct:rL:C:p:HD:P:V:FZMT:R:B:X:AQ:E:U")))
     {
         if (option == 'n')
             graphName = optarg;
         else if (option == 'k')
             k = stoi(optarg);
+        else if (option == 'm')
+            indexK = stoi(optarg);
         else if (option == 'd')
         {
             if (!densityList.count(optarg))
@@ -29,7 +74,52 @@ int main(int argc, char *argv[])
             labelSize = stoi(optarg);
         else if (option == 's')
             subgraphId = optarg;
+        else if (option == 'S')
+            streaming = true;
+        else if (option == 'c')
+            checkpoint = true;
+        else if (option == 't')
+            checkpointInterval = stod(optarg);
+        else if (option == 'r')
+            checkpoint = resume = true;
+        else if (option == 'L')
+            lazyBudget = stod(optarg);
+        else if (option == 'C')
+            categoryList = optarg;
+        else if (option == 'p')
+            workers = stoi(optarg);
+        else if (option == 'H')
+            sharing = true;
+        else if (option == 'D')
+            derivedRatio = stod(optarg);
+        else if (option == 'P')
+            profilePath = optarg;
+        else if (option == 'V')
+            sourcePath = optarg;
+        else if (option == 'F')
+            freezing = true;
+        else if (option == 'Z')
+            compressing = true;
+        else if (option == 'M')
+            mapping = true;
+        else if (option == 'T')
+            tierBudget = stod(optarg);
+        else if (option == 'R')
+            regionPath = optarg;
+        else if (option == 'B')
+            regionRadius = stoi(optarg);
+        else if (option == 'X')
+            regionBox = optarg;
+        else if (option == 'A')
+            lookup = true;
+        else if (option == 'Q')
+            queryThreads = stoi(optarg);
+        else if (option == 'E')
+            cacheEntries = stoi(optarg);
+        else if (option == 'U')
+            categoryUpdate = true;
     }
+    indexK = max(indexK, k);
     string folder = "datasets/" + graphName + "/";
 
     string graphPath = folder + "USA-road." + graphName + ".gr";
@@ -38,23 +128,182 @@ int main(int argc, char *argv[])
     string poiPath = folder + "/POI/POI" + poiDensity + ".txt";
     string orderPath = folder + "/order.txt";
     // string indexPath = folder + "/index/index" + indexFile + ".txt";
-    string indexPath = folder + "/index/index.k" + to_string(k) + ".density" + poiDensity + ".txt";
+    string indexPath = folder + "/index/index.k" + to_string(indexK) + ".density" + poiDensity + ".txt";
     if (subgraphId != "0")
-        indexPath = folder + "/index/index.k" + to_string(k) + ".density" + poiDensity + "." + subgraphId + ".txt";
+        indexPath = folder + "/index/index.k" + to_string(indexK) + ".density" + poiDensity + "." + subgraphId + ".txt";
     string queryFolder = folder + "/query";
     string indexFolder = folder + "/index";
     if (!filesystem::exists(indexFolder))
         filesystem::create_directory(indexFolder);
 
-    Graph graph(graphPath, labelSize, k);
+    Graph graph(graphPath, labelSize, indexK);
+    graph.queryK = k;
     printf("graph path: %s\n", graphPath.c_str());
 
+    if (!categoryList.empty())
+    {
+        stringstream ss(categoryList);
+        string density;
+        while (getline(ss, density, ','))
+            graph.loadCategory(density, folder + "/POI/POI" + density + ".txt");
+        graph.buildCategoryIndex();
+        if (categoryUpdate)
+        {
+            graph.updatePOI(folder + "insert.txt", 0);
+            graph.updatePOI(folder + "delete.txt", 0);
+        }
+        graph.queryCategory(queryFolder);
+        return 0;
+    }
+
     graph.loadPOI(poiPath);
 
-    graph.buildIndex();
+    string frozenPath = indexPath.substr(0, indexPath.size() - 4) + ".lcf";
+    if (mapping && filesystem::exists(frozenPath))
+    {
+        auto start = chrono::high_resolution_clock::now();
+        if (!graph.mapFrozenIndex(frozenPath, true, true))
+            return 0;
+        auto end = chrono::high_resolution_clock::now();
+        chrono::duration<double> duration = end - start;
+        printf("mapping time:%.6lfs\n", duration.count());
+        graph.query(queryFolder);
+        return 0;
+    }
 
-    graph.storeIndex2(indexPath);
+    if ((!regionPath.empty() || !regionBox.empty()) && filesystem::exists(indexPath))
+    {
+        vector<bool> region;
+        if (!regionPath.empty())
+        {
+            vector<int> seeds;
+            ifstream fin(regionPath);
+            int v;
+            while (fin >> v)
+                seeds.emplace_back(v);
+            fin.close();
+            region = graph.regionAround(seeds, regionRadius);
+        }
+        else
+        {
+            vector<double> box;
+            stringstream ss(regionBox);
+            string value;
+            while (getline(ss, value, ','))
+                box.emplace_back(stod(value));
+            if (box.size() != 4)
+            {
+                printf("please specify the region box -X as x1,y1,x2,y2\n");
+                return 0;
+            }
+            string coordinatePath = graphPath.substr(0, graphPath.size() - 3) + ".co";
+            region = graph.regionInBox(coordinatePath, box[0], box[1], box[2], box[3]);
+        }
+        if (!graph.loadRegionIndex(indexPath, region))
+            return 0;
+        graph.query(queryFolder);
+        graph.reportRegion();
+        return 0;
+    }
 
+    if (tierBudget > 0 && filesystem::exists(indexPath))
+    {
+        if (!graph.openTieredIndex(indexPath, tierBudget * 1024 * 1024))
+            return 0;
+        graph.query(queryFolder);
+        graph.reportTieredIndex();
+        return 0;
+    }
+
+    if (lazyBudget > 0)
+    {
+        graph.buildLazyIndex(lazyBudget * 1024 * 1024);
+        graph.query(queryFolder);
+        graph.reportLazyCache();
+        return 0;
+    }
+    else if (!sourcePath.empty())
+    {
+        vector<int> sources;
+        ifstream fin(sourcePath);
+        int v;
+        while (fin >> v)
+            sources.emplace_back(v);
+        fin.close();
+
+        indexPath = folder + "/index/index.k" + to_string(indexK) + ".density" + poiDensity + ".sources.txt";
+        graph.buildSourceIndex(sources);
+        graph.storeIndex2(indexPath);
+        graph.loadIndex2(indexPath);
+    }
+    else if (workers > 0)
+    {
+        if (!graph.buildDistributedIndex(indexPath, workers))
+            return 0;
+        graph.loadIndex2(indexPath);
+    }
+    else if (streaming)
+    {
+        if (!graph.buildIndex(indexPath))
+            return 0;
+        graph.loadIndex2(indexPath);
+    }
+    else if (checkpoint)
+    {
+        // the checkpoints of each index are kept apart, since they hold lists built for its POI
+        graph.checkpointFolder = folder + "/checkpoint/k" + to_string(indexK) + ".density" + poiDensity + (subgraphId != "0" ? "." + subgraphId : "");
+        graph.checkpointInterval = checkpointInterval;
+        graph.buildIndex(resume);
+        graph.storeIndex2(indexPath);
+    }
+    else
+    {
+        graph.buildIndex();
+        graph.storeIndex2(indexPath);
+    }
+
+    if (!profilePath.empty())
+        graph.pruneIndex(profilePath);
+    if (derivedRatio >= 0)
+        graph.deriveIndex(2, derivedRatio);
+    if (sharing)
+        graph.shareIndex();
+    if (freezing || mapping)
+        graph.freeze();
+    if (mapping)
+    {
+        graph.storeFrozenIndex(frozenPath);
+        graph.mapFrozenIndex(frozenPath, true, true);
+    }
+    if (compressing)
+    {
+        string compressedPath = indexPath.substr(0, indexPath.size() - 4) + ".lcz";
+        graph.compressIndex();
+        graph.storeCompressedIndex(compressedPath);
+        graph.loadCompressedIndex(compressedPath);
+    }
+    if (lookup)
+        graph.buildLabelLookup();
+    if (cacheEntries > 0)
+        graph.enableResultCache(cacheEntries, 16);
+    if (tierBudget > 0 && !graph.openTieredIndex(indexPath, tierBudget * 1024 * 1024))
+        return 0;
     graph.query(queryFolder);
+    if (tierBudget > 0)
+        graph.reportTieredIndex();
+    if (lookup)
+        graph.queryLookup(queryFolder);
+    if (queryThreads > 0)
+        graph.queryParallel(queryFolder, queryThreads);
+    if (cacheEntries > 0)
+    {
+        graph.queryByGroup(queryFolder);
+        graph.reportResultCache();
+    }
+    if (!profilePath.empty())
+    {
+        graph.queryByGroup(queryFolder);
+        graph.reportProfile();
+    }
     return 0;
 }
\ No newline at end of file
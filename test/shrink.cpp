@@ -0,0 +1,73 @@
+#include "../include/Graph.h"
+
+int main(int argc, char *argv[])
+{
+    string graphName = "COL";
+    int labelSize = 10;
+    int k = 20;
+    // k of the existing index
+    int indexK = 50;
+    string poiDensity = "005";
+    set<string> densityList = {"001", "005", "010", "050", "100"};
+    string subgraphId = "0";
+
+    int option = -1;
+    while (-1 != (option = getopt(argc, argv, "n:k:m:d:l:s:")))
+    {
+        if (option == 'n')
+            graphName = optarg;
+        else if (option == 'k')
+            k = stoi(optarg);
+        else if (option == 'm')
+            indexK = stoi(optarg);
+        else if (option == 'd')
+        {
+            if (!densityList.count(optarg))
+            {
+                printf("please specify the POI density -d in [\"001\", \"005\", \"010\", \"050\", \"100\"]\n");
+                return 0;
+            }
+            poiDensity = optarg;
+        }
+        else if (option == 'l')
+            labelSize = stoi(optarg);
+        else if (option == 's')
+            subgraphId = optarg;
+    }
+    if (k > indexK)
+    {
+        printf("please specify -k no larger than the k of the existing index -m\n");
+        return 0;
+    }
+    string folder = "datasets/" + graphName + "/";
+
+    string graphPath = folder + "USA-road." + graphName + ".gr";
+    if (subgraphId != "0")
+        graphPath = folder + "/subgraph/USA-road." + graphName + "." + subgraphId + ".gr";
+    string poiPath = folder + "/POI/POI" + poiDensity + ".txt";
+    string suffix = ".density" + poiDensity + (subgraphId != "0" ? "." + subgraphId : "") + ".txt";
+    string sourcePath = folder + "/index/index.k" + to_string(indexK) + suffix;
+    string targetPath = folder + "/index/index.k" + to_string(k) + suffix;
+    if (!filesystem::exists(sourcePath))
+    {
+        printf("index file %s does not exist\n", sourcePath.c_str());
+        return 0;
+    }
+
+    Graph graph(graphPath, labelSize, indexK);
+    printf("graph path: %s\n", graphPath.c_str());
+
+    graph.loadPOI(poiPath);
+
+    graph.loadIndex2(sourcePath);
+
+    auto start = chrono::high_resolution_clock::now();
+    graph.shrinkIndex(k);
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> duration = end - start;
+    printf("shrinking time:%.2lfs\n", duration.count());
+
+    graph.reportIndexSize();
+    graph.storeIndex2(targetPath);
+    return 0;
+}